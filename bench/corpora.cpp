@@ -0,0 +1,216 @@
+#include "corpora.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+namespace bench {
+namespace {
+
+class Rng {
+ public:
+  explicit Rng(uint64_t seed) : state_(seed) {}
+
+  uint64_t next() {
+    state_ = state_ * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state_ >> 33;
+  }
+  uint64_t below(uint64_t n) { return next() % n; }
+
+ private:
+  uint64_t state_;
+};
+
+std::string format_double(double value) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.17g", value);
+  return buf;
+}
+
+std::string make_twitter() {
+  static const char* kWords[] = {"json", "parser", "fast", "\\u00e9t\\u00e9", "caf\xc3\xa9", "stream", "query",
+                                 "\\\"quoted\\\"", "line\\nbreak", "\xe6\x97\xa5\xe6\x9c\xac", "data", "simd"};
+  static const char* kLangs[] = {"en", "ja", "es", "fr"};
+  Rng rng(1);
+  std::string out = "{\"statuses\": [";
+  for (int i = 0; i < 300; ++i) {
+    std::string id = std::to_string(505874924095815681ULL + static_cast<uint64_t>(i) * 7919);
+    std::string text;
+    for (uint64_t w = 0, n = 6 + rng.below(14); w < n; ++w) {
+      text += (w ? " " : "") + std::string(kWords[rng.below(12)]);
+    }
+    std::string hashtags;
+    for (uint64_t h = 0, n = rng.below(4); h < n; ++h) {
+      hashtags += std::string(h ? ", " : "") + "{\"text\": \"" + kWords[rng.below(3)] + "\", \"indices\": [" +
+                  std::to_string(h * 7) + ", " + std::to_string(h * 7 + 5) + "]}";
+    }
+    out += std::string(i ? ",\n" : "\n") + "  {\"metadata\": {\"result_type\": \"recent\", \"iso_language_code\": \"" +
+           kLangs[rng.below(4)] + "\"}, \"created_at\": \"Sun Aug 31 00:29:15 +0000 2014\", \"id\": " + id +
+           ", \"id_str\": \"" + id + "\", \"text\": \"" + text +
+           "\", \"source\": \"<a href=\\\"https://example.com\\\" rel=\\\"nofollow\\\">client</a>\", " +
+           "\"truncated\": false, \"in_reply_to_status_id\": null, \"user\": {\"id\": " +
+           std::to_string(1186275104 + i) + ", \"name\": \"user " + std::to_string(i) +
+           "\", \"screen_name\": \"user_" + std::to_string(i % 97) + "\", \"location\": \"\", \"description\": \"" +
+           kWords[rng.below(12)] + " enthusiast\", \"followers_count\": " + std::to_string(rng.below(100000)) +
+           ", \"friends_count\": " + std::to_string(rng.below(5000)) + ", \"verified\": " +
+           (rng.below(10) == 0 ? "true" : "false") + ", \"entities\": {\"description\": {\"urls\": []}}}, " +
+           "\"geo\": null, \"coordinates\": null, \"retweet_count\": " + std::to_string(rng.below(40)) +
+           ", \"favorite_count\": " + std::to_string(rng.below(100)) + ", \"entities\": {\"hashtags\": [" + hashtags +
+           "], \"symbols\": [], \"urls\": [], \"user_mentions\": []}, \"favorited\": false, \"retweeted\": false, " +
+           "\"lang\": \"" + kLangs[rng.below(4)] + "\"}";
+  }
+  out += "\n], \"search_metadata\": {\"completed_in\": 0.087, \"max_id\": 505874924095815681, \"query\": \"%23json\", "
+         "\"count\": 300, \"since_id\": 0}}";
+  return out;
+}
+
+std::string make_citm_catalog() {
+  Rng rng(2);
+  std::string out = "{\n\"areaNames\": {";
+  for (int i = 0; i < 17; ++i) {
+    out += std::string(i ? ", " : "") + "\"" + std::to_string(205705993 + i) + "\": \"Area " + std::to_string(i) + "\"";
+  }
+  out += "},\n\"events\": {";
+  for (int i = 0; i < 184; ++i) {
+    std::string id = std::to_string(138586341 + i * 4);
+    out += std::string(i ? ",\n" : "\n") + "  \"" + id + "\": {\"description\": null, \"id\": " + id +
+           ", \"logo\": null, \"name\": \"Event " + std::to_string(i) + "\", \"subTopicIds\": [337184269, " +
+           std::to_string(337184283 + rng.below(40)) + "], \"subjectCode\": null, \"subtitle\": null, \"topicIds\": [" +
+           std::to_string(324846099 + rng.below(10)) + ", 107888604]}";
+  }
+  out += "},\n\"performances\": [";
+  for (int i = 0; i < 243; ++i) {
+    out += std::string(i ? ",\n" : "\n") + "  {\"eventId\": " + std::to_string(138586341 + rng.below(184) * 4) +
+           ", \"id\": " + std::to_string(339887544 + i) + ", \"logo\": null, \"name\": null, \"prices\": [";
+    for (uint64_t p = 0, n = 1 + rng.below(4); p < n; ++p) {
+      out += std::string(p ? ", " : "") + "{\"amount\": " + std::to_string(9000 + rng.below(90) * 1000) +
+             ", \"audienceSubCategoryId\": 337100890, \"seatCategoryId\": " + std::to_string(338937295 + p) + "}";
+    }
+    out += "], \"seatCategories\": [";
+    for (uint64_t c = 0, n = 1 + rng.below(4); c < n; ++c) {
+      out += std::string(c ? ", " : "") + "{\"areas\": [";
+      for (uint64_t a = 0, m = 1 + rng.below(8); a < m; ++a) {
+        out += std::string(a ? ", " : "") + "{\"areaId\": " + std::to_string(205705993 + rng.below(17)) +
+               ", \"blockIds\": []}";
+      }
+      out += "], \"seatCategoryId\": " + std::to_string(338937295 + c) + "}";
+    }
+    out += "], \"seatMapImage\": null, \"start\": " + std::to_string(1372701600000ULL + i * 86400000ULL) +
+           ", \"venueCode\": \"PLEYEL_PLEYEL\"}";
+  }
+  out += "\n]\n}";
+  return out;
+}
+
+std::string make_canada() {
+  Rng rng(3);
+  std::string out =
+      "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+      "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[";
+  for (int ring = 0; ring < 40; ++ring) {
+    out += ring ? ",[" : "[";
+    for (int p = 0; p < 1400; ++p) {
+      double lon = -141.0 + static_cast<double>(rng.below(1000000000)) / 1e9 * 88.0;
+      double lat = 41.0 + static_cast<double>(rng.below(1000000000)) / 1e9 * 42.0;
+      out += (p ? ",[" : "[") + format_double(lon) + "," + format_double(lat) + "]";
+    }
+    out += "]";
+  }
+  out += "]}}]}";
+  return out;
+}
+
+std::string make_deep() {
+  std::string out = "[";
+  for (int copy = 0; copy < 200; ++copy) {
+    out += copy ? "," : "";
+    for (int depth = 0; depth < 500; ++depth) {
+      out += depth % 2 ? "{\"n\":" : "[";
+    }
+    out += std::to_string(copy);
+    for (int depth = 499; depth >= 0; --depth) {
+      out += depth % 2 ? "}" : "]";
+    }
+  }
+  out += "]";
+  return out;
+}
+
+std::string make_records() {
+  std::string out = "[\n";
+  for (size_t i = 0; i < 20000; ++i) {
+    if (i > 0) {
+      out += ",\n";
+    }
+    std::string id = std::to_string(i);
+    out += "  {\n";
+    out += "    \"id\": " + id + ",\n";
+    out += "    \"user\": {\"name\": \"user-" + id + "\", \"email\": \"user" + id + "@example.com\"},\n";
+    out += "    \"message\": \"request completed in " + id + " ms with status \\\"ok\\\"\",\n";
+    out += "    \"tags\": [\"alpha\", \"beta\", \"gamma\"],\n";
+    out += "    \"score\": " + std::to_string(i * 0.25) + ",\n";
+    out += "    \"active\": " + std::string(i % 2 ? "true" : "false") + "\n";
+    out += "  }";
+  }
+  out += "\n]\n";
+  return out;
+}
+
+std::string make_ndjson() {
+  std::string out;
+  for (size_t i = 0; i < 200000; ++i) {
+    out += "{\"ts\": " + std::to_string(1700000000000ULL + i) + ", \"level\": \"" + (i % 10 ? "info" : "error") +
+           "\", \"service\": \"api-" + std::to_string(i % 16) + "\", \"msg\": \"handled request " +
+           std::to_string(i) + "\", \"latency_ms\": " + std::to_string(i % 250) + "}\n";
+  }
+  return out;
+}
+
+std::string load(const std::string& name) {
+  if (name == "twitter" || name == "citm_catalog" || name == "canada") {
+    std::ifstream file("bench/data/" + name + ".json", std::ios::binary);
+    if (file) {
+      std::ostringstream data;
+      data << file.rdbuf();
+      return data.str();
+    }
+  }
+  if (name == "twitter") {
+    return make_twitter();
+  }
+  if (name == "citm_catalog") {
+    return make_citm_catalog();
+  }
+  if (name == "canada") {
+    return make_canada();
+  }
+  if (name == "deep") {
+    return make_deep();
+  }
+  if (name == "records") {
+    return make_records();
+  }
+  if (name == "ndjson") {
+    return make_ndjson();
+  }
+  throw std::invalid_argument("unknown corpus " + name);
+}
+
+}  // namespace
+
+const std::string& corpus(const std::string& name) {
+  static std::mutex mutex;
+  static std::map<std::string, std::string> cache;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = cache.find(name);
+  if (it == cache.end()) {
+    it = cache.emplace(name, load(name)).first;
+  }
+  return it->second;
+}
+
+}  // namespace bench
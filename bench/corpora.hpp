@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+namespace bench {
+
+// Benchmark inputs by name. The canonical corpora ("twitter", "citm_catalog",
+// "canada") are read from bench/data/<name>.json when that file exists;
+// otherwise, and for the rest, a deterministic synthetic input of the same
+// shape is generated once and cached:
+//   twitter       search results: nested objects, escapes, non-ASCII text
+//   citm_catalog  wide objects keyed by ids, arrays of small integer records
+//   canada        GeoJSON polygon, almost entirely floating point numbers
+//   deep          heavily nested arrays and objects
+//   records       pretty-printed event records
+//   ndjson        one compact log event per line
+const std::string& corpus(const std::string& name);
+
+}  // namespace bench
@@ -0,0 +1,89 @@
+#include "jsonpath/json.hpp"
+#include "jsonpath/serialize.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include "corpora.hpp"
+#include "structural_index.hpp"
+
+#include <string>
+
+namespace {
+
+void BM_StructuralIndex(benchmark::State& state, const char* name) {
+  const std::string& input = bench::corpus(name);
+  state.SetLabel(jsonpath::detail::structural_kernel_name());
+  for (auto _ : state) {
+    jsonpath::detail::StructuralIndex index(input);
+    size_t count = 0;
+    for (size_t pos = index.next(0); pos < input.size(); pos = index.next(pos + 1)) {
+      ++count;
+    }
+    benchmark::DoNotOptimize(count);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK_CAPTURE(BM_StructuralIndex, twitter, "twitter")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_StructuralIndex, records, "records")->Unit(benchmark::kMicrosecond);
+
+// Tree on the default allocator, as parse_json(std::string_view) builds it.
+void BM_ParseJson(benchmark::State& state, const char* name) {
+  const std::string& input = bench::corpus(name);
+  for (auto _ : state) {
+    jsonpath::Json doc = jsonpath::parse_json(input);
+    benchmark::DoNotOptimize(doc);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+// Arena-backed Document, reused across iterations.
+void BM_ParseDocument(benchmark::State& state, const char* name) {
+  const std::string& input = bench::corpus(name);
+  jsonpath::Document doc;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&jsonpath::parse_json(input, doc));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+void BM_ParseDocumentBorrowed(benchmark::State& state, const char* name) {
+  const std::string& input = bench::corpus(name);
+  jsonpath::Document doc;
+  jsonpath::ParseOptions options;
+  options.borrow_strings = true;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&jsonpath::parse_json(input, doc, options));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+// Writes the parsed corpus back out into a reused string; bytes are counted
+// on the input so the rate compares directly with parsing.
+void BM_ToJson(benchmark::State& state, const char* name) {
+  const std::string& input = bench::corpus(name);
+  jsonpath::Document doc;
+  const jsonpath::Json& root = jsonpath::parse_json(input, doc);
+  std::string out;
+  out.reserve(input.size());
+  for (auto _ : state) {
+    out.clear();
+    jsonpath::StringSink sink(out);
+    jsonpath::to_json(root, sink);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+#define PARSE_BENCHMARKS(corpus)                                                                  \
+  BENCHMARK_CAPTURE(BM_ParseJson, corpus, #corpus)->Unit(benchmark::kMicrosecond);                \
+  BENCHMARK_CAPTURE(BM_ParseDocument, corpus, #corpus)->Unit(benchmark::kMicrosecond);            \
+  BENCHMARK_CAPTURE(BM_ParseDocumentBorrowed, corpus, #corpus)->Unit(benchmark::kMicrosecond);     \
+  BENCHMARK_CAPTURE(BM_ToJson, corpus, #corpus)->Unit(benchmark::kMicrosecond)
+
+PARSE_BENCHMARKS(twitter);
+PARSE_BENCHMARKS(citm_catalog);
+PARSE_BENCHMARKS(canada);
+PARSE_BENCHMARKS(deep);
+PARSE_BENCHMARKS(records);
+
+}  // namespace
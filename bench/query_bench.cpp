@@ -0,0 +1,329 @@
+#include "jsonpath/cache.hpp"
+#include "jsonpath/jsonpath.hpp"
+#include "jsonpath/ndjson.hpp"
+#include "jsonpath/projection.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include "corpora.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+const jsonpath::Json& twitter_doc() {
+  static const jsonpath::Json doc = jsonpath::parse_json(bench::corpus("twitter"));
+  return doc;
+}
+
+// Evaluation only: the document is parsed once and the query compiled up front.
+void BM_Select(benchmark::State& state, const char* query) {
+  const jsonpath::Json& doc = twitter_doc();
+  auto path = jsonpath::JsonPath::compile(query);
+  size_t matches = 0;
+  for (auto _ : state) {
+    auto result = path.select(doc);
+    matches = result.size();
+    benchmark::DoNotOptimize(result);
+  }
+  state.counters["matches"] = static_cast<double>(matches);
+}
+
+// Selector kinds.
+BENCHMARK_CAPTURE(BM_Select, name, "$.search_metadata.count");
+BENCHMARK_CAPTURE(BM_Select, wildcard, "$.statuses[*].user.screen_name");
+BENCHMARK_CAPTURE(BM_Select, index, "$.statuses[150].text");
+BENCHMARK_CAPTURE(BM_Select, slice, "$.statuses[10:290:3].id");
+BENCHMARK_CAPTURE(BM_Select, filter, "$.statuses[?@.retweet_count > 20].id");
+BENCHMARK_CAPTURE(BM_Select, descendant, "$..screen_name");
+BENCHMARK_CAPTURE(BM_Select, descendant_wildcard, "$..*");
+
+// Functions.
+BENCHMARK_CAPTURE(BM_Select, length, "$.statuses[?length(@.text) > 60].id");
+BENCHMARK_CAPTURE(BM_Select, count, "$.statuses[?count(@.entities.hashtags[*]) > 1].id");
+BENCHMARK_CAPTURE(BM_Select, value, "$.statuses[?value(@.user.verified) == true].id");
+BENCHMARK_CAPTURE(BM_Select, match, "$.statuses[?match(@.lang, 'e.')].id");
+BENCHMARK_CAPTURE(BM_Select, search, "$.statuses[?search(@.text, 'js[o]n')].id");
+BENCHMARK_CAPTURE(BM_Select, search_dynamic, "$.statuses[?search(@.text, @.user.screen_name)].id");
+
+// Filters over a large array, where the per-candidate cost of evaluating the
+// filter expression dominates.
+void BM_Filter(benchmark::State& state, const char* query) {
+  static const jsonpath::Json doc = jsonpath::parse_json(bench::corpus("records"));
+  auto path = jsonpath::JsonPath::compile(query);
+  jsonpath::EvalScratch scratch;
+  std::vector<const jsonpath::Json*> out;
+  for (auto _ : state) {
+    path.select(doc, out, scratch);
+  }
+  state.counters["matches"] = static_cast<double>(out.size());
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * doc.as_array().size()));
+}
+BENCHMARK_CAPTURE(BM_Filter, compare, "$[?@.score > 1000].id")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Filter, logical, "$[?@.score > 1000 && @.active == true || @.user.name == 'user-7'].id")
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Filter, exists, "$[?@.tags[2] && !@.missing].id")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Filter, function, "$[?length(@.message) > 40].id")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Filter, root_path, "$[?@.score > $[0].score].id")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Filter, root_function, "$[?length(@.message) > length($[0].message)].id")
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_Filter, root_count, "$[?count($[0].tags[*]) > 2 && @.active == true].id")
+    ->Unit(benchmark::kMicrosecond);
+
+// The same queries with the output vector and EvalScratch kept across calls.
+void BM_SelectScratch(benchmark::State& state, const char* query) {
+  const jsonpath::Json& doc = twitter_doc();
+  auto path = jsonpath::JsonPath::compile(query);
+  jsonpath::EvalScratch scratch;
+  std::vector<const jsonpath::Json*> result;
+  for (auto _ : state) {
+    path.select(doc, result, scratch);
+    benchmark::DoNotOptimize(result.data());
+  }
+  state.counters["matches"] = static_cast<double>(result.size());
+}
+BENCHMARK_CAPTURE(BM_SelectScratch, wildcard, "$.statuses[*].user.screen_name");
+BENCHMARK_CAPTURE(BM_SelectScratch, filter, "$.statuses[?@.retweet_count > 20].id");
+BENCHMARK_CAPTURE(BM_SelectScratch, count, "$.statuses[?count(@.entities.hashtags[*]) > 1].id");
+BENCHMARK_CAPTURE(BM_SelectScratch, descendant, "$..screen_name");
+
+void BM_SelectWithPaths(benchmark::State& state, const char* query) {
+  const jsonpath::Json& doc = twitter_doc();
+  auto path = jsonpath::JsonPath::compile(query);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(path.select_with_paths(doc));
+  }
+}
+BENCHMARK_CAPTURE(BM_SelectWithPaths, wildcard, "$.statuses[*].user.screen_name");
+BENCHMARK_CAPTURE(BM_SelectWithPaths, descendant, "$..screen_name");
+
+// A singular query three ways: collected by select, stopped at the first
+// match, and followed directly by get.
+void BM_Singular(benchmark::State& state, int mode) {
+  const jsonpath::Json& doc = twitter_doc();
+  auto path = jsonpath::JsonPath::compile("$.statuses[150].user.screen_name");
+  for (auto _ : state) {
+    if (mode == 0) {
+      benchmark::DoNotOptimize(path.select(doc));
+    } else if (mode == 1) {
+      benchmark::DoNotOptimize(path.select_first(doc));
+    } else {
+      benchmark::DoNotOptimize(path.get(doc));
+    }
+  }
+}
+BENCHMARK_CAPTURE(BM_Singular, select, 0);
+BENCHMARK_CAPTURE(BM_Singular, first, 1);
+BENCHMARK_CAPTURE(BM_Singular, get, 2);
+
+// exists() stops at the first match; count() walks everything but keeps no list.
+void BM_Exists(benchmark::State& state) {
+  const jsonpath::Json& doc = twitter_doc();
+  auto path = jsonpath::JsonPath::compile("$..screen_name");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(path.exists(doc));
+  }
+}
+BENCHMARK(BM_Exists);
+
+void BM_Count(benchmark::State& state) {
+  const jsonpath::Json& doc = twitter_doc();
+  auto path = jsonpath::JsonPath::compile("$..screen_name");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(path.count(doc));
+  }
+}
+BENCHMARK(BM_Count);
+
+// Edits go through the same evaluation as select, so each should cost about
+// as much as selecting the same nodes.
+void BM_Edit(benchmark::State& state, int mode) {
+  jsonpath::Document doc;
+  jsonpath::parse_json(bench::corpus("records"), doc);
+  jsonpath::Json& root = doc.root();
+  auto path = jsonpath::JsonPath::compile("$[*].score");
+  jsonpath::Json zero(0.0);
+  auto reset = [](jsonpath::Json& node) { node = jsonpath::Json(0.0); };
+  for (auto _ : state) {
+    switch (mode) {
+      case 0: benchmark::DoNotOptimize(path.select(root)); break;
+      case 1: benchmark::DoNotOptimize(path.assign(root, zero)); break;
+      default: benchmark::DoNotOptimize(path.update(root, reset)); break;
+    }
+  }
+}
+BENCHMARK_CAPTURE(BM_Edit, select, 0);
+BENCHMARK_CAPTURE(BM_Edit, assign, 1);
+BENCHMARK_CAPTURE(BM_Edit, update, 2);
+
+// Text in, pruned text out: through a parsed tree, or straight from the raw
+// text. Raw projection pays off when the matches are sparse.
+void BM_Project(benchmark::State& state, const char* name, std::vector<const char*> queries, bool raw) {
+  const std::string& input = bench::corpus(name);
+  std::vector<jsonpath::JsonPath> paths;
+  for (const char* query : queries) {
+    paths.push_back(jsonpath::JsonPath::compile(query));
+  }
+  jsonpath::Projection projection(std::move(paths));
+  jsonpath::Document doc;
+  std::string out;
+  for (auto _ : state) {
+    out.clear();
+    jsonpath::StringSink sink(out);
+    if (raw) {
+      projection.project_raw(input, sink);
+    } else {
+      projection.project(jsonpath::parse_json(input, doc), sink);
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK_CAPTURE(BM_Project, records_tree, "records", {"$[*].id", "$[*].user.email", "$[*].active"}, false)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Project, records_raw, "records", {"$[*].id", "$[*].user.email", "$[*].active"}, true)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Project, twitter_tree, "twitter", {"$.statuses[0].user.name", "$.search_metadata"}, false)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Project, twitter_raw, "twitter", {"$.statuses[0].user.name", "$.search_metadata"}, true)
+    ->Unit(benchmark::kMillisecond);
+
+// A rules-engine style workload: many queries sharing a few prefixes,
+// evaluated against one small event, as a set and one query at a time.
+const jsonpath::Json& event_doc() {
+  static const jsonpath::Json doc = [] {
+    std::string text = R"({"meta": {"source": "gateway", "region": "eu"}, "payload": {"headers": {)";
+    for (int i = 0; i < 100; ++i) {
+      text += (i ? ", \"h" : "\"h") + std::to_string(i) + "\": \"value-" + std::to_string(i) + "\"";
+    }
+    text += R"(}, "body": {"items": [)";
+    for (int i = 0; i < 20; ++i) {
+      text += (i ? ", " : "") + std::string("{\"k0\": ") + std::to_string(i) + ", \"k1\": \"x\", \"k2\": [1, 2]}";
+    }
+    text += "]}}}";
+    return jsonpath::parse_json(text);
+  }();
+  return doc;
+}
+
+std::vector<jsonpath::JsonPath> event_rules(size_t count) {
+  std::vector<jsonpath::JsonPath> rules;
+  for (size_t i = 0; i < count; ++i) {
+    std::string n = std::to_string(i);
+    switch (i % 4) {
+      case 0: rules.push_back(jsonpath::JsonPath::compile("$.payload.headers.h" + std::to_string(i % 150))); break;
+      case 1: rules.push_back(jsonpath::JsonPath::compile("$.payload.body.items[*].k" + std::to_string(i % 5))); break;
+      case 2: rules.push_back(jsonpath::JsonPath::compile("$.payload.body.items[?@.k0 > " + n + "].k1")); break;
+      default: rules.push_back(jsonpath::JsonPath::compile("$.meta.m" + std::to_string(i % 50))); break;
+    }
+  }
+  return rules;
+}
+
+void BM_PathSet(benchmark::State& state) {
+  const jsonpath::Json& doc = event_doc();
+  jsonpath::JsonPathSet set;
+  for (const auto& rule : event_rules(static_cast<size_t>(state.range(0)))) {
+    set.add(rule);
+  }
+  jsonpath::EvalScratch scratch;
+  size_t matched = 0;
+  auto on_match = [&](size_t, const std::vector<const jsonpath::Json*>& matches) { matched += matches.size(); };
+  for (auto _ : state) {
+    set.evaluate(doc, on_match, scratch);
+  }
+  benchmark::DoNotOptimize(matched);
+}
+BENCHMARK(BM_PathSet)->Arg(100)->Arg(800);
+
+void BM_PathLoop(benchmark::State& state) {
+  const jsonpath::Json& doc = event_doc();
+  auto rules = event_rules(static_cast<size_t>(state.range(0)));
+  jsonpath::EvalScratch scratch;
+  std::vector<const jsonpath::Json*> out;
+  for (auto _ : state) {
+    for (const auto& rule : rules) {
+      rule.select(doc, out, scratch);
+    }
+  }
+}
+BENCHMARK(BM_PathLoop)->Arg(100)->Arg(800);
+
+void BM_Compile(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        jsonpath::JsonPath::compile("$.statuses[?@.retweet_count > 20 && match(@.lang, 'e.')].user['name','id']"));
+  }
+}
+BENCHMARK(BM_Compile);
+
+// The same query looked up in a JsonPathCache, from one thread and from
+// several at once.
+void BM_CompileCached(benchmark::State& state) {
+  static jsonpath::JsonPathCache cache;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        cache.get("$.statuses[?@.retweet_count > 20 && match(@.lang, 'e.')].user['name','id']"));
+  }
+}
+BENCHMARK(BM_CompileCached)->Threads(1)->Threads(4);
+
+void BM_SelectParsed(benchmark::State& state, const char* query) {
+  const std::string& input = bench::corpus("records");
+  auto path = jsonpath::JsonPath::compile(query);
+  jsonpath::Document doc;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(path.select(jsonpath::parse_json(input, doc)));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK_CAPTURE(BM_SelectParsed, index, "$[10000].user.name")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_SelectParsed, wildcard, "$[*].user.name")->Unit(benchmark::kMillisecond);
+
+void BM_SelectRaw(benchmark::State& state, const char* query) {
+  const std::string& input = bench::corpus("records");
+  auto path = jsonpath::JsonPath::compile(query);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(path.select_raw(input));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK_CAPTURE(BM_SelectRaw, index, "$[10000].user.name")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_SelectRaw, wildcard, "$[*].user.name")->Unit(benchmark::kMillisecond);
+
+void BM_SelectStream(benchmark::State& state) {
+  const std::string& input = bench::corpus("records");
+  auto path = jsonpath::JsonPath::compile("$[*].user.name");
+  for (auto _ : state) {
+    size_t offset = 0;
+    size_t matches = 0;
+    path.select_stream(
+        [&](char* buffer, size_t capacity) {
+          size_t n = std::min(capacity, input.size() - offset);
+          std::memcpy(buffer, input.data() + offset, n);
+          offset += n;
+          return n;
+        },
+        [&](const jsonpath::Json&) { ++matches; });
+    benchmark::DoNotOptimize(matches);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK(BM_SelectStream)->Unit(benchmark::kMillisecond);
+
+void BM_SelectNdjson(benchmark::State& state) {
+  const std::string& input = bench::corpus("ndjson");
+  auto path = jsonpath::JsonPath::compile("$.latency_ms");
+  jsonpath::NdjsonOptions options;
+  options.threads = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(jsonpath::select_ndjson(input, path, options));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK(BM_SelectNdjson)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "jsonpath/jsonpath.hpp"
+
+namespace jsonpath {
+
+// Compiled queries by path text, for code that builds its queries as strings.
+// Bounded: once full, the least recently used query is dropped. Thread-safe;
+// paths are spread over shards by hash, each with its own lock and LRU order,
+// so threads looking up different paths rarely wait on each other.
+class JsonPathCache {
+ public:
+  // capacity is the total number of queries kept, divided as evenly as it
+  // goes between the shards; there are never more shards than capacity. Throws
+  // std::invalid_argument if capacity or shards is 0.
+  explicit JsonPathCache(size_t capacity = 1024, size_t shards = 16);
+  ~JsonPathCache();
+  JsonPathCache(const JsonPathCache&) = delete;
+  JsonPathCache& operator=(const JsonPathCache&) = delete;
+
+  // The compiled query for path, compiling it on a miss. Compilation runs
+  // outside the lock. Throws like JsonPath::compile; invalid paths are not
+  // cached.
+  JsonPath get(std::string_view path);
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+  Stats stats() const;
+
+  size_t size() const;
+  size_t capacity() const;
+  // Drops every query; the counters are kept. Queries that get() is compiling
+  // meanwhile are returned but not kept.
+  void clear();
+
+  // The cache behind select(root, path) and select_raw(json, path). Cleared
+  // by register_function.
+  static JsonPathCache& shared();
+
+ private:
+  struct Shard;
+  std::unique_ptr<Shard[]> shards_;
+  size_t shard_count_;
+  size_t capacity_;
+
+  Shard& shard_for(std::string_view path) const;
+};
+
+}  // namespace jsonpath
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "jsonpath/json.hpp"
+
+namespace jsonpath {
+
+// Declared types of function parameters and results (RFC 9535, 2.4.1).
+enum class FunctionType { Value, Logical, Nodes };
+
+// One evaluated argument, filled according to its declared type. A Value
+// argument is null when it is Nothing.
+struct FunctionArg {
+  const Json* value = nullptr;
+  const std::vector<const Json*>* nodes = nullptr;
+  bool logical = false;
+};
+
+// Result of a call. A Value function either points ref at a node it was
+// given or sets value; leaving both empty returns Nothing. A Logical function
+// sets logical.
+struct FunctionValue {
+  const Json* ref = nullptr;
+  std::optional<Json> value;
+  bool logical = false;
+};
+
+using Function = std::function<FunctionValue(const FunctionArg* args, size_t count)>;
+
+constexpr size_t kMaxFunctionParams = 8;
+
+// Makes name available to queries compiled from now on, replacing an earlier
+// registration of the same name; queries already compiled keep the function
+// they were compiled with. Empties JsonPathCache::shared(), so that
+// select(root, path) compiles path again. Arguments are type-checked when a query is
+// compiled, so impl receives exactly params.size() arguments of the declared
+// types. impl may be called from several threads at once.
+//
+// Throws std::invalid_argument if name is not a valid function name
+// (lowercase letter, then lowercase letters, digits or '_'), is a standard
+// function or true/false/null, if result is Nodes, or if there are more than
+// kMaxFunctionParams parameters.
+void register_function(const std::string& name, FunctionType result, std::vector<FunctionType> params,
+                       Function impl);
+
+}  // namespace jsonpath
@@ -1,19 +1,223 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace jsonpath {
 
+struct Json;
+
+// Object member name. Keys of up to kInlineSize bytes are stored inline; longer
+// keys either point into caller-owned input (borrowed, see
+// ParseOptions::borrow_strings), into storage the owning JsonObject
+// allocates from its memory resource, or into one copy shared by all the
+// objects of a Document that use the key (interned).
+class JsonKey {
+ public:
+  static constexpr size_t kInlineSize = 16;
+  static constexpr size_t kMaxSize = (1U << 30) - 1;
+
+  std::string_view view() const {
+    return std::string_view(is_inline() ? storage_.small : storage_.ptr, size());
+  }
+  operator std::string_view() const { return view(); }
+  size_t size() const { return size_ & kSizeMask; }
+  bool borrowed() const { return (size_ & kBorrowed) != 0; }
+  bool interned() const { return (size_ & kInterned) != 0; }
+
+  friend bool operator==(const JsonKey& key, std::string_view other) { return key.view() == other; }
+  friend bool operator!=(const JsonKey& key, std::string_view other) { return key.view() != other; }
+
+ private:
+  friend class JsonObject;
+
+  static constexpr uint32_t kBorrowed = 1U << 31;
+  static constexpr uint32_t kInterned = 1U << 30;
+  static constexpr uint32_t kSizeMask = (1U << 30) - 1;
+
+  union {
+    const char* ptr;
+    char small[kInlineSize];
+  } storage_{};
+  uint32_t size_ = 0;
+
+  bool is_inline() const { return !borrowed() && !interned() && size() <= kInlineSize; }
+  bool allocated() const { return !borrowed() && !interned() && size() > kInlineSize; }
+};
+
+// Insertion-ordered object stored as parallel key/value vectors. Small objects
+// are searched linearly; once an object grows past kIndexThreshold members an
+// open-addressed hash index over the keys is maintained alongside, allocated
+// from the same memory resource as the members.
+class JsonObject {
+ public:
+  using String = std::pmr::string;
+  using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+  static constexpr size_t kIndexThreshold = 16;
+
+  template <bool Const>
+  class Iterator {
+   public:
+    using Value = std::conditional_t<Const, const std::shared_ptr<Json>, std::shared_ptr<Json>>;
+    using Owner = std::conditional_t<Const, const JsonObject, JsonObject>;
+    using value_type = std::pair<std::string_view, Value&>;
+    using reference = value_type;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::forward_iterator_tag;
+
+    struct pointer {
+      value_type pair;
+      const value_type* operator->() const { return &pair; }
+    };
+
+    Iterator() = default;
+    Iterator(Owner* owner, size_t pos) : owner_(owner), pos_(pos) {}
+    template <bool C = Const, typename = std::enable_if_t<C>>
+    Iterator(const Iterator<false>& other) : owner_(other.owner()), pos_(other.index()) {}
+
+    reference operator*() const { return {owner_->keys_[pos_].view(), owner_->values_[pos_]}; }
+    pointer operator->() const { return pointer{**this}; }
+    Iterator& operator++() {
+      ++pos_;
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator prev = *this;
+      ++pos_;
+      return prev;
+    }
+    bool operator==(const Iterator& other) const { return pos_ == other.pos_; }
+    bool operator!=(const Iterator& other) const { return pos_ != other.pos_; }
+
+    Owner* owner() const { return owner_; }
+    size_t index() const { return pos_; }
+
+   private:
+    Owner* owner_ = nullptr;
+    size_t pos_ = 0;
+  };
+
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  JsonObject() = default;
+  explicit JsonObject(const allocator_type& alloc) : keys_(alloc), values_(alloc), index_(alloc) {}
+  JsonObject(const JsonObject& other);
+  JsonObject(JsonObject&& other) noexcept = default;
+  JsonObject& operator=(const JsonObject& other);
+  JsonObject& operator=(JsonObject&& other);
+  ~JsonObject();
+
+  allocator_type get_allocator() const { return keys_.get_allocator(); }
+
+  size_t size() const { return keys_.size(); }
+  bool empty() const { return keys_.empty(); }
+  void reserve(size_t n) {
+    keys_.reserve(n);
+    values_.reserve(n);
+  }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+  // Members in insertion order; wildcard traversal sweeps values() directly.
+  const std::pmr::vector<JsonKey>& keys() const { return keys_; }
+  const std::pmr::vector<std::shared_ptr<Json>>& values() const { return values_; }
+
+  iterator find(std::string_view key) { return iterator(this, find_index(key)); }
+  const_iterator find(std::string_view key) const { return const_iterator(this, find_index(key)); }
+  // As find, with hash = hash_key(key) worked out beforehand, so a key looked
+  // up in many objects is hashed once.
+  iterator find(std::string_view key, size_t hash) { return iterator(this, find_index(key, hash)); }
+  const_iterator find(std::string_view key, size_t hash) const { return const_iterator(this, find_index(key, hash)); }
+  static size_t hash_key(std::string_view key) { return std::hash<std::string_view>{}(key); }
+  bool contains(std::string_view key) const { return find_index(key) != size(); }
+  size_t count(std::string_view key) const { return contains(key) ? 1 : 0; }
+
+  std::shared_ptr<Json>& at(std::string_view key);
+  const std::shared_ptr<Json>& at(std::string_view key) const;
+  std::shared_ptr<Json>& operator[](std::string_view key);
+
+  // Replaces the value of an existing key in place, keeping its position.
+  std::pair<iterator, bool> insert_or_assign(std::string_view key, std::shared_ptr<Json> value);
+  // As insert_or_assign, but a long key is referenced rather than copied and
+  // must outlive the object.
+  std::pair<iterator, bool> insert_or_assign_borrowed(std::string_view key, std::shared_ptr<Json> value);
+  // As insert_or_assign_borrowed, for a long key stored once for many objects
+  // in this object's memory resource. Unlike a borrowed key, it is copied when
+  // the object is copied.
+  std::pair<iterator, bool> insert_or_assign_interned(std::string_view key, std::shared_ptr<Json> value);
+  size_t erase(std::string_view key);
+  iterator erase(const_iterator pos);
+  // Erases the members for which pred(key, value) is true, in one pass that
+  // moves the others down and reindexes once. pred is called exactly once
+  // per member, in order, and may move the value out of one it erases.
+  // Returns the number erased.
+  template <typename Pred>
+  size_t erase_if(Pred pred);
+  void clear();
+
+ private:
+  std::pmr::vector<JsonKey> keys_;
+  std::pmr::vector<std::shared_ptr<Json>> values_;
+  // Slots hold (hash >> 32) << 32 | (position + 1); zero marks an empty slot.
+  std::pmr::vector<uint64_t> index_;
+
+  enum class KeyStorage { Owned, Borrowed, Interned };
+
+  size_t find_index(std::string_view key) const;
+  size_t find_index(std::string_view key, size_t hash) const;
+  std::pair<iterator, bool> insert_key(std::string_view key, std::shared_ptr<Json> value, KeyStorage storage);
+  JsonKey make_key(std::string_view key, KeyStorage storage);
+  void release_keys();
+  void own_keys();
+  void index_insert(size_t pos, size_t hash);
+  void index_erase(size_t pos);
+  void release_key(JsonKey& key);
+  void reindex();
+  void rebuild_index();
+};
+
+template <typename Pred>
+size_t JsonObject::erase_if(Pred pred) {
+  size_t kept = 0;
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    if (pred(keys_[i].view(), values_[i])) {
+      release_key(keys_[i]);
+      continue;
+    }
+    if (kept != i) {
+      keys_[kept] = keys_[i];
+      values_[kept] = std::move(values_[i]);
+    }
+    ++kept;
+  }
+  size_t erased = size() - kept;
+  if (erased > 0) {
+    keys_.resize(kept);
+    values_.resize(kept);
+    reindex();
+  }
+  return erased;
+}
+
 struct Json {
-  using Object = std::unordered_map<std::string, std::shared_ptr<Json>>;
-  using Array = std::vector<std::shared_ptr<Json>>;
-  using Value = std::variant<std::nullptr_t, bool, double, std::string, Array, Object>;
+  using String = std::pmr::string;
+  using Object = JsonObject;
+  using Array = std::pmr::vector<std::shared_ptr<Json>>;
+  using Value = std::variant<std::nullptr_t, bool, double, int64_t, uint64_t, String, std::string_view, Array, Object>;
 
   Value value;
 
@@ -21,29 +225,108 @@ struct Json {
   explicit Json(std::nullptr_t) : value(nullptr) {}
   explicit Json(bool b) : value(b) {}
   explicit Json(double n) : value(n) {}
-  explicit Json(std::string s) : value(std::move(s)) {}
-  explicit Json(const char* s) : value(std::string(s)) {}
+  explicit Json(int n) : value(static_cast<int64_t>(n)) {}
+  explicit Json(int64_t n) : value(n) {}
+  explicit Json(uint64_t n) : value(n) {}
+  explicit Json(const std::string& s) : value(String(s)) {}
+  explicit Json(String s) : value(std::move(s)) {}
+  explicit Json(const char* s) : value(String(s)) {}
+  // A string that references s instead of copying it; s must outlive the value.
+  static Json borrow(std::string_view s) {
+    Json json;
+    json.value = s;
+    return json;
+  }
   explicit Json(Array a) : value(std::move(a)) {}
   explicit Json(Object o) : value(std::move(o)) {}
 
   bool is_null() const { return std::holds_alternative<std::nullptr_t>(value); }
   bool is_bool() const { return std::holds_alternative<bool>(value); }
-  bool is_number() const { return std::holds_alternative<double>(value); }
-  bool is_string() const { return std::holds_alternative<std::string>(value); }
+  bool is_number() const { return is_double() || is_integer(); }
+  bool is_double() const { return std::holds_alternative<double>(value); }
+  bool is_integer() const {
+    return std::holds_alternative<int64_t>(value) || std::holds_alternative<uint64_t>(value);
+  }
+  bool is_string() const {
+    return std::holds_alternative<String>(value) || std::holds_alternative<std::string_view>(value);
+  }
   bool is_array() const { return std::holds_alternative<Array>(value); }
   bool is_object() const { return std::holds_alternative<Object>(value); }
 
   bool as_bool() const { return std::get<bool>(value); }
-  double as_number() const { return std::get<double>(value); }
-  const std::string& as_string() const { return std::get<std::string>(value); }
+  // Any numeric alternative as a double; integers above 2^53 may round.
+  double as_number() const {
+    if (const auto* i = std::get_if<int64_t>(&value)) {
+      return static_cast<double>(*i);
+    }
+    if (const auto* u = std::get_if<uint64_t>(&value)) {
+      return static_cast<double>(*u);
+    }
+    return std::get<double>(value);
+  }
+  int64_t as_int64() const { return std::get<int64_t>(value); }
+  uint64_t as_uint64() const { return std::get<uint64_t>(value); }
+  std::string_view as_string() const {
+    if (const auto* view = std::get_if<std::string_view>(&value)) {
+      return *view;
+    }
+    return std::get<String>(value);
+  }
   const Array& as_array() const { return std::get<Array>(value); }
   const Object& as_object() const { return std::get<Object>(value); }
   Array& as_array() { return std::get<Array>(value); }
   Object& as_object() { return std::get<Object>(value); }
 };
 
-Json parse_json(std::string_view input);
+struct ParseOptions {
+  // Store escape-free strings and object keys as views into the input rather
+  // than copies; only strings containing escapes are decoded into owned
+  // storage. The input buffer must then outlive the parsed value.
+  bool borrow_strings = false;
+  // Objects and arrays nested deeper than this are rejected with
+  // std::runtime_error, as the parser recurses into them.
+  size_t max_depth = 1024;
+};
+
+// A parsed document whose nodes, strings and containers all live in one
+// monotonic arena. The arena is released in one shot when the document is
+// destroyed or re-parsed; node destructors never run, so pointers into the
+// tree must not outlive the document, and nodes added after parsing should be
+// allocated from resource(). Member names too long to store inline are kept
+// once per distinct name and shared by every object that uses it.
+class Document {
+ public:
+  Document();
+  explicit Document(size_t initial_bytes);
+  Document(Document&& other) noexcept = default;
+  Document& operator=(Document&& other) noexcept = default;
+
+  const Json& root() const { return *root_; }
+  Json& root() { return *root_; }
+  std::pmr::memory_resource* resource() const { return arena_.get(); }
+
+ private:
+  friend const Json& parse_json(std::string_view input, Document& document, const ParseOptions& options);
+  friend const Json& parse_json_file(const std::string& path, Document& document, const ParseOptions& options);
+
+  std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+  Json* root_ = nullptr;
+  // Keeps the input alive when the tree borrows from it, e.g. a file mapping.
+  std::shared_ptr<const void> source_;
+};
+
+Json parse_json(std::string_view input, const ParseOptions& options = {});
+
+const Json& parse_json(std::string_view input, Document& document, const ParseOptions& options = {});
+
+// Parses a file through a read-only memory mapping instead of a copy. The
+// document owns the mapping, so borrowed strings stay valid as long as it.
+const Json& parse_json_file(const std::string& path, Document& document, const ParseOptions& options = {});
 
 bool json_equal(const Json& lhs, const Json& rhs);
 
+// Exact three-way comparison of two numeric values (-1, 0 or 1), mixing
+// integer and floating alternatives without rounding either side.
+int compare_numbers(const Json& lhs, const Json& rhs);
+
 }  // namespace jsonpath
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <functional>
+#include <iosfwd>
 #include <memory>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -8,19 +11,197 @@
 
 namespace jsonpath {
 
+namespace detail {
+class EvalBuffers;
+struct PathStep;
+struct PathArena;
+struct QueryTrie;
+}
+
+class JsonPathSet;
+class Projection;
+
+// Working memory for JsonPath::select and JsonPathSet::evaluate: the node
+// lists passed between segments and nested filter queries, and the
+// descendant walk stack. Keeping one across calls lets them run without
+// allocating once the buffers have grown to fit. Not thread-safe; use one per
+// thread.
+class EvalScratch {
+ public:
+  EvalScratch();
+  ~EvalScratch();
+  EvalScratch(EvalScratch&&) noexcept;
+  EvalScratch& operator=(EvalScratch&&) noexcept;
+
+ private:
+  friend class JsonPath;
+  friend class JsonPathSet;
+  std::unique_ptr<detail::EvalBuffers> buffers_;
+};
+
+// Location of a matched node: the member names and array indices leading to
+// it from the root. Locations are links into a chain of steps shared by all
+// matches of one select_with_paths call, so they cost one small record per
+// step and are only turned into text on request. Member names point into the
+// document's keys.
+class NodePath {
+ public:
+  struct Element {
+    bool is_index;
+    std::string_view name;  // member name when !is_index
+    size_t index;           // array index when is_index
+  };
+
+  // Steps from the root; empty for the root itself.
+  std::vector<Element> elements() const;
+  // The Normalized Path (RFC 9535, 2.7), e.g. $['store']['book'][0].
+  std::string normalized() const;
+
+ private:
+  friend class JsonPath;
+  const detail::PathStep* step_ = nullptr;
+};
+
+struct PathMatch {
+  const Json* node;
+  NodePath path;
+};
+
+// Matches from select_with_paths, with the steps their paths refer to.
+class PathMatches {
+ public:
+  using const_iterator = std::vector<PathMatch>::const_iterator;
+
+  size_t size() const { return matches_.size(); }
+  bool empty() const { return matches_.empty(); }
+  const PathMatch& operator[](size_t i) const { return matches_[i]; }
+  const_iterator begin() const { return matches_.begin(); }
+  const_iterator end() const { return matches_.end(); }
+
+ private:
+  friend class JsonPath;
+  std::vector<PathMatch> matches_;
+  std::shared_ptr<const detail::PathArena> steps_;
+};
+
 class JsonPath {
  public:
   static JsonPath compile(std::string_view path);
 
   std::vector<const Json*> select(const Json& root) const;
+  // Replaces the contents of out with the matches, reusing its capacity.
+  void select(const Json& root, std::vector<const Json*>& out, EvalScratch& scratch) const;
+
+  // Calls on_match with each match in document order until it returns false.
+  // Matches are passed on as soon as they are found, so stopping early skips
+  // the rest of the evaluation. Returns false if on_match stopped it.
+  using NodeCallback = std::function<bool(const Json&)>;
+  bool for_each(const Json& root, const NodeCallback& on_match) const;
+
+  // These stop at the first match: the match itself, or nullptr if none.
+  const Json* select_first(const Json& root) const;
+  bool exists(const Json& root) const;
+  // Counts the matches without collecting them.
+  size_t count(const Json& root) const;
+
+  // For singular queries, made of names and indices only (such as
+  // $.a.b[0].c): the node selected, or nullptr if there is none. Follows the
+  // path from node to child without collecting matches, so it never
+  // allocates. Throws std::runtime_error if the query is not singular.
+  const Json* get(const Json& root) const;
+  Json* get_mut(Json& root) const;
+
+  // select, also reporting where each match is. Locations are built up as
+  // the query runs rather than by searching for each match afterwards.
+  PathMatches select_with_paths(const Json& root) const;
+
+  // In-place edits of a mutable document. The query runs to completion
+  // first, then the matches are edited in reverse document order, so editing
+  // a node never invalidates a match inside it; a node matched more than once
+  // is edited once. Each returns the number of nodes edited.
+  //
+  // assign replaces each match with a deep copy of value, allocated from the
+  // memory resource of root's storage. A root that is a number, boolean or
+  // null has no storage and copies come from the default resource, so edit a
+  // Document through the overload taking it, which always uses its arena.
+  size_t assign(Json& root, const Json& value) const;
+  size_t assign(Document& document, const Json& value) const;
+  // Removes each match from its array or object. The root has no parent and
+  // is never removed.
+  size_t remove(Json& root) const;
+  size_t update(Json& root, const std::function<void(Json&)>& fn) const;
+
+  // Evaluates against unparsed JSON text, skipping the subtrees the query
+  // cannot reach and parsing only the matched values (and filter candidates).
+  // Only the parts of the input the query visits are checked, and the first
+  // of any duplicated member names is used. Queries with descendant segments
+  // or filters that refer to $ fall back to a full parse.
+  std::vector<Json> select_raw(std::string_view json) const;
+
+  // Fills buffer with up to capacity bytes and returns the count; 0 means end
+  // of input.
+  using ChunkSource = std::function<size_t(char* buffer, size_t capacity)>;
+  using MatchCallback = std::function<void(const Json&)>;
+
+  // Evaluates against JSON read incrementally from source, calling on_match
+  // for each match in document order. Only one chunk of input is buffered;
+  // beyond that, memory is bounded by the largest value the query has to
+  // materialize: each match, each filter candidate, and the node under any
+  // segment that cannot be streamed (unions, negative indices or steps,
+  // descendant segments). As with select_raw, the first of any duplicated
+  // member names is used. Filters that refer to $ are rejected.
+  void select_stream(const ChunkSource& source, const MatchCallback& on_match) const;
+  void select_stream(std::istream& in, const MatchCallback& on_match) const;
 
  private:
+  friend class JsonPathSet;
+  friend class Projection;
   struct Impl;
   std::shared_ptr<const Impl> impl_;
 
   explicit JsonPath(std::shared_ptr<const Impl> impl);
 };
 
+// Many queries evaluated against a document together. Queries are merged on
+// their common leading segments, so a prefix shared by many of them is
+// evaluated once per document, and everything below a segment that matched
+// nothing is skipped. Segments with filters are compared by identity, so
+// only the part of a query before its first filter is shared.
+class JsonPathSet {
+ public:
+  JsonPathSet();
+  ~JsonPathSet();
+  JsonPathSet(JsonPathSet&&) noexcept;
+  JsonPathSet& operator=(JsonPathSet&&) noexcept;
+
+  // Returns the query's id; ids count up from 0 in the order added.
+  size_t add(const JsonPath& path);
+  size_t size() const { return paths_.size(); }
+
+  // Calls on_match once for every query with at least one match, with its
+  // matches in the order select would return them. Queries are reported in
+  // no particular order.
+  using MatchCallback = std::function<void(size_t id, const std::vector<const Json*>& matches)>;
+  void evaluate(const Json& root, const MatchCallback& on_match) const;
+  void evaluate(const Json& root, const MatchCallback& on_match, EvalScratch& scratch) const;
+
+  // The matches of every query, indexed by id.
+  std::vector<std::vector<const Json*>> select(const Json& root) const;
+
+ private:
+  std::vector<JsonPath> paths_;
+  std::unique_ptr<detail::QueryTrie> trie_;
+  size_t hoisted_runs_ = 0;
+  size_t hoisted_values_ = 0;
+};
+
+// These compile path through JsonPathCache::shared(), so repeating a path
+// does not parse it again.
 std::vector<const Json*> select(const Json& root, std::string_view path);
 
+std::vector<Json> select_raw(std::string_view json, std::string_view path);
+
+// select_raw over a read-only memory mapping of the file at file_path.
+std::vector<Json> select_file(const std::string& file_path, const JsonPath& path);
+
 }  // namespace jsonpath
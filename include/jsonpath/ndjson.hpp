@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "jsonpath/jsonpath.hpp"
+
+namespace jsonpath {
+
+struct NdjsonMatch {
+  size_t line;  // 1-based line number in the input
+  Json value;
+};
+
+struct NdjsonOptions {
+  // Worker threads; 0 uses std::thread::hardware_concurrency().
+  size_t threads = 0;
+  // Keep matches in input order; otherwise they are grouped per worker, which
+  // skips the reordering step.
+  bool ordered = true;
+  // Input is handed to workers in slices of about this many bytes.
+  size_t batch_bytes = 1 << 20;
+};
+
+// Evaluates path against every line of newline-delimited JSON (NDJSON / JSON
+// Lines) on a pool of worker threads. Blank lines are skipped and each line
+// is evaluated like JsonPath::select_raw. If any line fails, the error for the
+// earliest such line is thrown after all workers finish, prefixed with its
+// line number.
+std::vector<NdjsonMatch> select_ndjson(std::string_view input, const JsonPath& path,
+                                       const NdjsonOptions& options = {});
+
+// select_ndjson over a read-only memory mapping of the file at file_path.
+std::vector<NdjsonMatch> select_ndjson_file(const std::string& file_path, const JsonPath& path,
+                                            const NdjsonOptions& options = {});
+
+}  // namespace jsonpath
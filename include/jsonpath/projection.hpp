@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "jsonpath/jsonpath.hpp"
+#include "jsonpath/serialize.hpp"
+
+namespace jsonpath {
+
+// Prunes a document down to what a set of queries select: every match, and
+// the members and array elements leading to it from the root. Everything
+// else is left out without being copied or, for unparsed input, parsed.
+// Array elements keep their order but are renumbered, and a root that
+// nothing matched in comes out as an empty object or array (or null).
+class Projection {
+ public:
+  explicit Projection(std::vector<JsonPath> paths);
+
+  // The pruned document. Matched subtrees are shared with root rather than
+  // copied, so root must outlive the result; only the containers leading to
+  // them are new.
+  Json project(const Json& root) const;
+
+  // Writes the pruned document to sink without building it.
+  void project(const Json& root, Sink& sink, const SerializeOptions& options = {}) const;
+
+  // As above, on unparsed JSON text. Matched values are copied from the input
+  // as they are written there, and subtrees holding no match are skipped
+  // unread. Falls back to a full parse under the same conditions as
+  // JsonPath::select_raw.
+  void project_raw(std::string_view json, Sink& sink, const SerializeOptions& options = {}) const;
+
+ private:
+  std::vector<JsonPath> paths_;
+};
+
+}  // namespace jsonpath
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "jsonpath/json.hpp"
+
+namespace jsonpath {
+
+// Destination for to_json. Output is gathered in a fixed buffer and handed to
+// flush_bytes in large pieces, so writing a document never builds it up as
+// one string unless the sink itself does.
+class Sink {
+ public:
+  virtual ~Sink() = default;
+  Sink(const Sink&) = delete;
+  Sink& operator=(const Sink&) = delete;
+
+  void put(char c) {
+    if (size_ == capacity_) {
+      flush();
+    }
+    buffer_[size_++] = c;
+  }
+
+  void write(std::string_view s) {
+    if (s.size() <= capacity_ - size_) {
+      std::memcpy(buffer_.get() + size_, s.data(), s.size());
+      size_ += s.size();
+      return;
+    }
+    write_slow(s);
+  }
+
+  // Hands everything buffered so far to flush_bytes.
+  void flush();
+
+ protected:
+  explicit Sink(size_t capacity = 64 * 1024);
+
+  virtual void flush_bytes(const char* data, size_t size) = 0;
+
+ private:
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+  size_t size_ = 0;
+
+  void write_slow(std::string_view s);
+};
+
+// Appends to a string.
+class StringSink : public Sink {
+ public:
+  explicit StringSink(std::string& out) : out_(out) {}
+
+ protected:
+  void flush_bytes(const char* data, size_t size) override { out_.append(data, size); }
+
+ private:
+  std::string& out_;
+};
+
+// Writes to a file descriptor, which stays owned by the caller. Throws
+// std::runtime_error if a write fails.
+class FdSink : public Sink {
+ public:
+  explicit FdSink(int fd) : fd_(fd) {}
+
+ protected:
+  void flush_bytes(const char* data, size_t size) override;
+
+ private:
+  int fd_;
+};
+
+// Passes each flushed piece to a callback.
+class CallbackSink : public Sink {
+ public:
+  using Callback = std::function<void(std::string_view)>;
+
+  explicit CallbackSink(Callback callback, size_t capacity = 64 * 1024)
+      : Sink(capacity), callback_(std::move(callback)) {}
+
+ protected:
+  void flush_bytes(const char* data, size_t size) override { callback_(std::string_view(data, size)); }
+
+ private:
+  Callback callback_;
+};
+
+struct SerializeOptions {
+  // One member or element per line, indented by indent spaces per level.
+  bool pretty = false;
+  size_t indent = 2;
+};
+
+// Writes value as JSON text and flushes the sink. Doubles are written in
+// their shortest round-tripping form, keeping a fraction or exponent so they
+// parse back as doubles. Strings are written as stored, escaping only what
+// JSON requires. Throws std::invalid_argument for NaN or infinity.
+void to_json(const Json& value, Sink& sink, const SerializeOptions& options = {});
+
+std::string to_json(const Json& value, const SerializeOptions& options = {});
+
+}  // namespace jsonpath
@@ -0,0 +1,119 @@
+#include "jsonpath/cache.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace jsonpath {
+
+// Entries are kept most recently used first. The index is keyed by views of
+// the entries' own path strings, which list nodes keep in place, so lookups
+// need no copy of the path. clear() bumps generation, so that a query
+// compiled before it is not added afterwards.
+struct JsonPathCache::Shard {
+  using Entry = std::pair<std::string, JsonPath>;
+
+  mutable std::mutex mutex;
+  std::list<Entry> entries;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+  Stats stats;
+  uint64_t generation = 0;
+  size_t capacity = 0;
+};
+
+JsonPathCache::JsonPathCache(size_t capacity, size_t shards) {
+  if (capacity == 0 || shards == 0) {
+    throw std::invalid_argument("JsonPathCache needs a capacity and at least one shard");
+  }
+  shard_count_ = std::min(shards, capacity);
+  capacity_ = capacity;
+  shards_ = std::make_unique<Shard[]>(shard_count_);
+  // The first capacity % shard_count_ shards take one more query each.
+  for (size_t i = 0; i < shard_count_; ++i) {
+    shards_[i].capacity = capacity / shard_count_ + (i < capacity % shard_count_ ? 1 : 0);
+  }
+}
+
+JsonPathCache::~JsonPathCache() = default;
+
+JsonPathCache::Shard& JsonPathCache::shard_for(std::string_view path) const {
+  return shards_[std::hash<std::string_view>()(path) % shard_count_];
+}
+
+JsonPath JsonPathCache::get(std::string_view path) {
+  Shard& shard = shard_for(path);
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(path);
+    if (it != shard.index.end()) {
+      ++shard.stats.hits;
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      return it->second->second;
+    }
+    ++shard.stats.misses;
+    generation = shard.generation;
+  }
+
+  JsonPath compiled = JsonPath::compile(path);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // Another thread may have compiled the same path meanwhile, or the cache
+  // may have been cleared since, perhaps for a function registered after
+  // compiled looked it up.
+  if (shard.generation != generation || shard.index.find(path) != shard.index.end()) {
+    return compiled;
+  }
+  shard.entries.emplace_front(std::string(path), compiled);
+  shard.index.emplace(shard.entries.front().first, shard.entries.begin());
+  if (shard.entries.size() > shard.capacity) {
+    shard.index.erase(shard.entries.back().first);
+    shard.entries.pop_back();
+    ++shard.stats.evictions;
+  }
+  return compiled;
+}
+
+JsonPathCache::Stats JsonPathCache::stats() const {
+  Stats total;
+  for (size_t i = 0; i < shard_count_; ++i) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    total.hits += shards_[i].stats.hits;
+    total.misses += shards_[i].stats.misses;
+    total.evictions += shards_[i].stats.evictions;
+  }
+  return total;
+}
+
+size_t JsonPathCache::size() const {
+  size_t size = 0;
+  for (size_t i = 0; i < shard_count_; ++i) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    size += shards_[i].entries.size();
+  }
+  return size;
+}
+
+size_t JsonPathCache::capacity() const {
+  return capacity_;
+}
+
+void JsonPathCache::clear() {
+  for (size_t i = 0; i < shard_count_; ++i) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    shards_[i].index.clear();
+    shards_[i].entries.clear();
+    ++shards_[i].generation;
+  }
+}
+
+JsonPathCache& JsonPathCache::shared() {
+  static JsonPathCache cache;
+  return cache;
+}
+
+}  // namespace jsonpath
@@ -0,0 +1,503 @@
+#include "iregexp.hpp"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+namespace jsonpath {
+namespace detail {
+namespace {
+
+constexpr uint32_t kMaxCodepoint = 0x10FFFF;
+constexpr uint32_t kReplacement = 0xFFFD;
+constexpr int kMaxRepeat = 100;
+constexpr size_t kMaxNfaStates = 10000;
+constexpr size_t kMaxDfaStates = 4096;
+constexpr size_t kMaxTransitions = size_t{1} << 22;
+
+// Inclusive code point ranges, sorted and disjoint once normalized.
+using Ranges = std::vector<std::pair<uint32_t, uint32_t>>;
+
+struct Unsupported {};
+
+// Decodes one UTF-8 sequence at pos, substituting U+FFFD for malformed input.
+uint32_t decode_utf8(std::string_view text, size_t& pos) {
+  unsigned char lead = static_cast<unsigned char>(text[pos++]);
+  if (lead < 0x80) {
+    return lead;
+  }
+  int extra = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : -1;
+  if (extra < 0 || lead > 0xF4 || pos + static_cast<size_t>(extra) > text.size()) {
+    return kReplacement;
+  }
+  uint32_t codepoint = lead & (0x3F >> extra);
+  for (int i = 0; i < extra; ++i) {
+    unsigned char c = static_cast<unsigned char>(text[pos + static_cast<size_t>(i)]);
+    if ((c & 0xC0) != 0x80) {
+      return kReplacement;
+    }
+    codepoint = (codepoint << 6) | (c & 0x3F);
+  }
+  static constexpr uint32_t kMinForLength[] = {0, 0x80, 0x800, 0x10000};
+  if (codepoint < kMinForLength[extra] || codepoint > kMaxCodepoint || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+    return kReplacement;
+  }
+  pos += static_cast<size_t>(extra);
+  return codepoint;
+}
+
+Ranges normalize(Ranges ranges) {
+  std::sort(ranges.begin(), ranges.end());
+  Ranges out;
+  for (const auto& range : ranges) {
+    if (!out.empty() && range.first <= out.back().second + 1) {
+      out.back().second = std::max(out.back().second, range.second);
+    } else {
+      out.push_back(range);
+    }
+  }
+  return out;
+}
+
+Ranges complement(const Ranges& ranges) {
+  Ranges out;
+  uint32_t next = 0;
+  for (const auto& range : ranges) {
+    if (range.first > next) {
+      out.emplace_back(next, range.first - 1);
+    }
+    next = range.second + 1;
+  }
+  if (next <= kMaxCodepoint) {
+    out.emplace_back(next, kMaxCodepoint);
+  }
+  return out;
+}
+
+struct Node {
+  enum Kind { Set, Concat, Alt, Repeat };
+  Kind kind = Concat;
+  Ranges set;
+  std::vector<Node> children;
+  int min = 0;
+  int max = 0;  // -1 for unbounded
+};
+
+// Recursive descent over the RFC 9485 grammar.
+class PatternParser {
+ public:
+  explicit PatternParser(std::string_view pattern) {
+    for (size_t pos = 0; pos < pattern.size();) {
+      size_t start = pos;
+      uint32_t codepoint = decode_utf8(pattern, pos);
+      if (codepoint == kReplacement && pattern.substr(start, pos - start) != "\xEF\xBF\xBD") {
+        throw Unsupported{};
+      }
+      chars_.push_back(codepoint);
+    }
+  }
+
+  Node parse() {
+    Node node = alternation();
+    if (pos_ != chars_.size()) {
+      throw Unsupported{};
+    }
+    return node;
+  }
+
+ private:
+  std::vector<uint32_t> chars_;
+  size_t pos_ = 0;
+
+  bool at_end() const { return pos_ >= chars_.size(); }
+  uint32_t peek(size_t ahead = 0) const { return pos_ + ahead < chars_.size() ? chars_[pos_ + ahead] : 0x110000; }
+  uint32_t next() {
+    if (at_end()) {
+      throw Unsupported{};
+    }
+    return chars_[pos_++];
+  }
+
+  Node alternation() {
+    Node node;
+    node.kind = Node::Alt;
+    node.children.push_back(branch());
+    while (peek() == '|') {
+      ++pos_;
+      node.children.push_back(branch());
+    }
+    if (node.children.size() == 1) {
+      return std::move(node.children.front());
+    }
+    return node;
+  }
+
+  Node branch() {
+    Node node;
+    node.kind = Node::Concat;
+    while (!at_end() && peek() != '|' && peek() != ')') {
+      node.children.push_back(piece());
+    }
+    return node;
+  }
+
+  Node piece() {
+    Node atom_node = atom();
+    int min = 1;
+    int max = 1;
+    uint32_t c = peek();
+    if (c == '*') {
+      min = 0;
+      max = -1;
+    } else if (c == '+') {
+      max = -1;
+    } else if (c == '?') {
+      min = 0;
+    } else if (c == '{') {
+      ++pos_;
+      min = quantity();
+      max = min;
+      if (peek() == ',') {
+        ++pos_;
+        max = peek() == '}' ? -1 : quantity();
+      }
+      if (peek() != '}' || (max >= 0 && max < min)) {
+        throw Unsupported{};
+      }
+    } else {
+      return atom_node;
+    }
+    ++pos_;
+    Node node;
+    node.kind = Node::Repeat;
+    node.min = min;
+    node.max = max;
+    node.children.push_back(std::move(atom_node));
+    return node;
+  }
+
+  int quantity() {
+    int value = 0;
+    size_t digits = 0;
+    while (peek() >= '0' && peek() <= '9') {
+      value = value * 10 + static_cast<int>(next() - '0');
+      if (value > kMaxRepeat) {
+        throw Unsupported{};
+      }
+      ++digits;
+    }
+    if (digits == 0) {
+      throw Unsupported{};
+    }
+    return value;
+  }
+
+  static Node set_node(Ranges ranges) {
+    Node node;
+    node.kind = Node::Set;
+    node.set = normalize(std::move(ranges));
+    return node;
+  }
+
+  Node atom() {
+    uint32_t c = next();
+    switch (c) {
+      case '(': {
+        Node node = alternation();
+        if (next() != ')') {
+          throw Unsupported{};
+        }
+        return node;
+      }
+      case '.':
+        return set_node({{0, '\n' - 1}, {'\n' + 1, '\r' - 1}, {'\r' + 1, kMaxCodepoint}});
+      case '[':
+        return char_class();
+      case '\\': {
+        uint32_t escaped = escape();
+        return set_node({{escaped, escaped}});
+      }
+      case ')': case '*': case '+': case '?': case ']': case '{': case '|': case '}':
+      case '^': case '$':
+        throw Unsupported{};
+      default:
+        return set_node({{c, c}});
+    }
+  }
+
+  // SingleCharEsc after a backslash; category escapes (\p, \P) are not
+  // supported.
+  uint32_t escape() {
+    uint32_t c = next();
+    switch (c) {
+      case '(': case ')': case '*': case '+': case '-': case '.': case '?': case '[': case '\\': case ']':
+      case '^': case '{': case '|': case '}':
+        return c;
+      case 'n':
+        return '\n';
+      case 'r':
+        return '\r';
+      case 't':
+        return '\t';
+      default:
+        throw Unsupported{};
+    }
+  }
+
+  uint32_t class_char() {
+    uint32_t c = next();
+    if (c == '\\') {
+      return escape();
+    }
+    if (c == '[' || c == ']' || c == '-') {
+      throw Unsupported{};
+    }
+    return c;
+  }
+
+  Node char_class() {
+    bool negate = false;
+    if (peek() == '^') {
+      ++pos_;
+      negate = true;
+    }
+    Ranges ranges;
+    if (peek() == '-') {
+      ++pos_;
+      ranges.emplace_back('-', '-');
+    }
+    while (true) {
+      uint32_t c = peek();
+      if (c == ']') {
+        ++pos_;
+        break;
+      }
+      if (c == '-') {
+        ++pos_;
+        if (next() != ']') {
+          throw Unsupported{};
+        }
+        ranges.emplace_back('-', '-');
+        break;
+      }
+      uint32_t lo = class_char();
+      uint32_t hi = lo;
+      if (peek() == '-' && peek(1) != ']') {
+        ++pos_;
+        hi = class_char();
+        if (hi < lo) {
+          throw Unsupported{};
+        }
+      }
+      ranges.emplace_back(lo, hi);
+    }
+    ranges = normalize(std::move(ranges));
+    return set_node(negate ? complement(ranges) : ranges);
+  }
+};
+
+struct NfaState {
+  enum Kind { Set, Split, Match };
+  Kind kind;
+  Ranges set;
+  std::vector<int> outs;
+};
+
+class Nfa {
+ public:
+  std::vector<NfaState> states;
+
+  int add(NfaState state) {
+    if (states.size() >= kMaxNfaStates) {
+      throw Unsupported{};
+    }
+    states.push_back(std::move(state));
+    return static_cast<int>(states.size() - 1);
+  }
+
+  // Builds node in front of the already built continuation next.
+  int build(const Node& node, int next) {
+    switch (node.kind) {
+      case Node::Set:
+        return add({NfaState::Set, node.set, {next}});
+      case Node::Concat:
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+          next = build(*it, next);
+        }
+        return next;
+      case Node::Alt: {
+        std::vector<int> outs;
+        for (const Node& child : node.children) {
+          outs.push_back(build(child, next));
+        }
+        return add({NfaState::Split, {}, std::move(outs)});
+      }
+      case Node::Repeat: {
+        const Node& child = node.children.front();
+        int start = next;
+        if (node.max < 0) {
+          int loop = add({NfaState::Split, {}, {}});
+          int body = build(child, loop);
+          states[static_cast<size_t>(loop)].outs = {body, next};
+          start = loop;
+        } else {
+          for (int i = node.min; i < node.max; ++i) {
+            start = add({NfaState::Split, {}, {build(child, start), next}});
+          }
+        }
+        for (int i = 0; i < node.min; ++i) {
+          start = build(child, start);
+        }
+        return start;
+      }
+    }
+    return next;
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<IRegexp> IRegexp::compile(std::string_view pattern, bool search) {
+  Nfa nfa;
+  int match = nfa.add({NfaState::Match, {}, {}});
+  int start = 0;
+  try {
+    Node root = PatternParser(pattern).parse();
+    start = nfa.build(root, match);
+  } catch (const Unsupported&) {
+    return nullptr;
+  }
+
+  auto regex = std::unique_ptr<IRegexp>(new IRegexp());
+  regex->search_ = search;
+
+  // Partition the code points at every range edge in the pattern.
+  std::vector<uint32_t>& bounds = regex->bounds_;
+  bounds = {0, kMaxCodepoint + 1};
+  for (const NfaState& state : nfa.states) {
+    for (const auto& range : state.set) {
+      bounds.push_back(range.first);
+      bounds.push_back(range.second + 1);
+    }
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  size_t classes = bounds.size() - 1;
+  regex->classes_ = classes;
+  for (uint32_t c = 0; c < 128; ++c) {
+    regex->ascii_class_[c] = static_cast<uint32_t>(regex->class_of(c));
+  }
+
+  std::vector<std::vector<uint8_t>> accepts(nfa.states.size());
+  for (size_t s = 0; s < nfa.states.size(); ++s) {
+    if (nfa.states[s].kind != NfaState::Set) {
+      continue;
+    }
+    accepts[s].assign(classes, 0);
+    for (const auto& range : nfa.states[s].set) {
+      size_t i = static_cast<size_t>(std::lower_bound(bounds.begin(), bounds.end(), range.first) - bounds.begin());
+      for (; i < classes && bounds[i] <= range.second; ++i) {
+        accepts[s][i] = 1;
+      }
+    }
+  }
+
+  // Epsilon closure as a sorted set of Set and Match states.
+  std::vector<uint32_t> seen(nfa.states.size(), 0);
+  uint32_t generation = 0;
+  std::vector<int> stack;
+  auto close = [&](std::vector<int>& roots) {
+    ++generation;
+    std::vector<int> out;
+    stack = roots;
+    while (!stack.empty()) {
+      int s = stack.back();
+      stack.pop_back();
+      if (seen[static_cast<size_t>(s)] == generation) {
+        continue;
+      }
+      seen[static_cast<size_t>(s)] = generation;
+      const NfaState& state = nfa.states[static_cast<size_t>(s)];
+      if (state.kind == NfaState::Split) {
+        stack.insert(stack.end(), state.outs.rbegin(), state.outs.rend());
+      } else {
+        out.push_back(s);
+      }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+  };
+
+  std::vector<int> roots{start};
+  std::vector<int> initial = close(roots);
+  std::map<std::vector<int>, int32_t> ids;
+  std::vector<std::vector<int>> sets;
+  auto intern = [&](std::vector<int> set) {
+    auto it = ids.find(set);
+    if (it != ids.end()) {
+      return it->second;
+    }
+    int32_t id = static_cast<int32_t>(sets.size());
+    ids.emplace(set, id);
+    sets.push_back(std::move(set));
+    return id;
+  };
+  intern(initial);
+
+  for (size_t d = 0; d < sets.size(); ++d) {
+    if (sets.size() > kMaxDfaStates || sets.size() * classes > kMaxTransitions) {
+      return nullptr;
+    }
+    bool accepting = std::binary_search(sets[d].begin(), sets[d].end(), match);
+    regex->accepting_.push_back(accepting ? 1 : 0);
+    for (size_t c = 0; c < classes; ++c) {
+      roots.clear();
+      // A search that already matched stays matched; nothing to explore.
+      if (!(search && accepting)) {
+        for (int s : sets[d]) {
+          if (nfa.states[static_cast<size_t>(s)].kind == NfaState::Set && accepts[static_cast<size_t>(s)][c]) {
+            roots.push_back(nfa.states[static_cast<size_t>(s)].outs.front());
+          }
+        }
+        if (search) {
+          roots.push_back(start);
+        }
+      }
+      std::vector<int> next = close(roots);
+      regex->transitions_.push_back(next.empty() ? -1 : intern(std::move(next)));
+    }
+  }
+  return regex;
+}
+
+bool IRegexp::matches(std::string_view text) const {
+  int32_t state = 0;
+  if (search_ && accepting_[0]) {
+    return true;
+  }
+  for (size_t pos = 0; pos < text.size();) {
+    unsigned char byte = static_cast<unsigned char>(text[pos]);
+    size_t cls;
+    if (byte < 0x80) {
+      cls = ascii_class_[byte];
+      ++pos;
+    } else {
+      cls = class_of(decode_utf8(text, pos));
+    }
+    state = transitions_[static_cast<size_t>(state) * classes_ + cls];
+    if (state < 0) {
+      return false;
+    }
+    if (search_ && accepting_[static_cast<size_t>(state)]) {
+      return true;
+    }
+  }
+  return accepting_[static_cast<size_t>(state)] != 0;
+}
+
+size_t IRegexp::class_of(uint32_t codepoint) const {
+  return static_cast<size_t>(std::upper_bound(bounds_.begin(), bounds_.end(), codepoint) - bounds_.begin()) - 1;
+}
+
+}  // namespace detail
+}  // namespace jsonpath
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace jsonpath {
+namespace detail {
+
+// I-Regexp (RFC 9485) compiled ahead of time to a DFA over code point
+// classes, so matching is linear in the input and never backtracks. The DFA
+// is immutable once built and safe to share between threads.
+class IRegexp {
+ public:
+  // Returns nullptr when pattern is outside the subset handled here: not
+  // valid I-Regexp, using \p{..} categories, containing an unescaped ^ or $
+  // (literals in I-Regexp but anchors to ECMAScript users), or needing more
+  // DFA states than the build budget allows. With search set, the DFA matches
+  // any substring instead of the whole input.
+  static std::unique_ptr<IRegexp> compile(std::string_view pattern, bool search);
+
+  bool matches(std::string_view text) const;
+
+ private:
+  // Code points are grouped into classes that every character set in the
+  // pattern treats alike; class i covers [bounds_[i], bounds_[i + 1]).
+  std::vector<uint32_t> bounds_;
+  uint32_t ascii_class_[128] = {};
+  size_t classes_ = 0;
+  // transitions_[state * classes_ + class] is the next state, or -1 once no
+  // match is possible.
+  std::vector<int32_t> transitions_;
+  std::vector<uint8_t> accepting_;
+  bool search_ = false;
+
+  size_t class_of(uint32_t codepoint) const;
+};
+
+}  // namespace detail
+}  // namespace jsonpath
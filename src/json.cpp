@@ -1,17 +1,32 @@
 #include "jsonpath/json.hpp"
 
-#include <cctype>
-#include <cerrno>
-#include <cstdlib>
+#include "mapped_file.hpp"
+#include "number_parse.hpp"
+#include "structural_index.hpp"
+
+#include <algorithm>
 #include <cstring>
+#include <iterator>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 
 namespace jsonpath {
 namespace {
 
 class Parser {
  public:
-  explicit Parser(std::string_view input) : input_(input), pos_(0) {}
+  Parser(std::string_view input, std::pmr::memory_resource* resource, const ParseOptions& options,
+         bool intern_keys = false)
+      : input_(input),
+        pos_(0),
+        resource_(resource),
+        borrow_strings_(options.borrow_strings),
+        max_depth_(options.max_depth),
+        intern_keys_(intern_keys),
+        index_(input) {}
 
   Json parse() {
     Json value = parse_value();
@@ -25,10 +40,55 @@ class Parser {
  private:
   std::string_view input_;
   size_t pos_;
+  std::pmr::memory_resource* resource_;
+  bool borrow_strings_;
+  size_t max_depth_;
+  size_t depth_ = 0;
+  // Store each distinct long key once in resource_, which must then outlive
+  // every object parsed (a Document's arena).
+  bool intern_keys_;
+  std::unordered_set<std::string_view> interned_;
+  detail::StructuralIndex index_;
+  // Children of the containers currently being parsed; each container moves
+  // its slice out once complete so it is allocated exactly once at final size.
+  std::vector<std::shared_ptr<Json>> stack_;
+  // Keys of the objects being parsed: slices of the input when they hold no
+  // escapes, otherwise decoded copies packed into key_chars_.
+  struct PendingKey {
+    size_t offset;
+    size_t size;
+    bool from_input;
+  };
+  std::vector<PendingKey> key_stack_;
+  std::string key_chars_;
+  std::string scratch_;
+
+  void insert_key(Json::Object& obj, std::string_view key, std::shared_ptr<Json> value) {
+    if (!intern_keys_ || key.size() <= JsonKey::kInlineSize) {
+      obj.insert_or_assign(key, std::move(value));
+      return;
+    }
+    auto it = interned_.find(key);
+    if (it == interned_.end()) {
+      char* chars = static_cast<char*>(resource_->allocate(key.size(), 1));
+      std::memcpy(chars, key.data(), key.size());
+      it = interned_.insert(std::string_view(chars, key.size())).first;
+    }
+    obj.insert_or_assign_interned(*it, std::move(value));
+  }
+
+  std::shared_ptr<Json> make_node(Json&& value) {
+    return std::allocate_shared<Json>(std::pmr::polymorphic_allocator<Json>(resource_), std::move(value));
+  }
+
+  static bool is_ws(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
 
+  // Whitespace runs end at the next indexed token, so skip straight to it.
   void skip_ws() {
-    while (pos_ < input_.size() && std::isspace(static_cast<unsigned char>(input_[pos_]))) {
-      ++pos_;
+    if (pos_ < input_.size() && is_ws(input_[pos_])) {
+      pos_ = index_.next(pos_ + 1);
     }
   }
 
@@ -49,14 +109,23 @@ class Parser {
   Json parse_value() {
     skip_ws();
     char c = peek();
-    if (c == '{') {
-      return parse_object();
-    }
-    if (c == '[') {
-      return parse_array();
+    if (c == '{' || c == '[') {
+      // Containers are parsed recursively; the limit keeps hostile input from
+      // running the stack out.
+      if (depth_ == max_depth_) {
+        throw error("Maximum nesting depth exceeded");
+      }
+      ++depth_;
+      Json value = c == '{' ? parse_object() : parse_array();
+      --depth_;
+      return value;
     }
     if (c == '"') {
-      return Json(parse_string('"'));
+      std::string_view text;
+      if (parse_string('"', text) && borrow_strings_) {
+        return Json::borrow(text);
+      }
+      return Json(Json::String(text, resource_));
     }
     if (c == 't') {
       expect("true");
@@ -70,8 +139,8 @@ class Parser {
       expect("null");
       return Json(nullptr);
     }
-    if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
-      return Json(parse_number());
+    if (c == '-' || is_digit(c)) {
+      return parse_number();
     }
     throw error("Invalid JSON value");
   }
@@ -79,23 +148,31 @@ class Parser {
   Json parse_object() {
     get();
     skip_ws();
-    Json::Object obj;
+    Json::Object obj(resource_);
     if (peek() == '}') {
       get();
       return Json(std::move(obj));
     }
+    size_t base = stack_.size();
+    size_t chars_base = key_chars_.size();
     while (true) {
       skip_ws();
       if (peek() != '"') {
         throw error("Expected string key");
       }
-      std::string key = parse_string('"');
+      std::string_view key;
+      if (parse_string('"', key)) {
+        key_stack_.push_back({static_cast<size_t>(key.data() - input_.data()), key.size(), true});
+      } else {
+        key_stack_.push_back({key_chars_.size(), key.size(), false});
+        key_chars_ += key;
+      }
       skip_ws();
       if (get() != ':') {
         throw error("Expected ':' after key");
       }
       Json value = parse_value();
-      obj[std::move(key)] = std::make_shared<Json>(std::move(value));
+      stack_.push_back(make_node(std::move(value)));
       skip_ws();
       char c = get();
       if (c == '}') {
@@ -105,20 +182,36 @@ class Parser {
         throw error("Expected ',' or '}' in object");
       }
     }
+    size_t count = stack_.size() - base;
+    obj.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      const PendingKey& key = key_stack_[key_stack_.size() - count + i];
+      if (!key.from_input) {
+        insert_key(obj, std::string_view(key_chars_).substr(key.offset, key.size), std::move(stack_[base + i]));
+      } else if (borrow_strings_) {
+        obj.insert_or_assign_borrowed(input_.substr(key.offset, key.size), std::move(stack_[base + i]));
+      } else {
+        insert_key(obj, input_.substr(key.offset, key.size), std::move(stack_[base + i]));
+      }
+    }
+    stack_.resize(base);
+    key_stack_.resize(key_stack_.size() - count);
+    key_chars_.resize(chars_base);
     return Json(std::move(obj));
   }
 
   Json parse_array() {
     get();
     skip_ws();
-    Json::Array arr;
+    Json::Array arr(resource_);
     if (peek() == ']') {
       get();
       return Json(std::move(arr));
     }
+    size_t base = stack_.size();
     while (true) {
       Json value = parse_value();
-      arr.push_back(std::make_shared<Json>(std::move(value)));
+      stack_.push_back(make_node(std::move(value)));
       skip_ws();
       char c = get();
       if (c == ']') {
@@ -128,6 +221,9 @@ class Parser {
         throw error("Expected ',' or ']' in array");
       }
     }
+    arr.reserve(stack_.size() - base);
+    std::move(stack_.begin() + static_cast<std::ptrdiff_t>(base), stack_.end(), std::back_inserter(arr));
+    stack_.resize(base);
     return Json(std::move(arr));
   }
 
@@ -177,11 +273,22 @@ class Parser {
     }
   }
 
-  std::string parse_string(char quote) {
+  // Strings the index reports as free of escapes and control characters are
+  // returned as a slice of the input (result true); everything else takes the
+  // byte-at-a-time path and is decoded into scratch_, valid until the next call.
+  bool parse_string(char quote, std::string_view& text) {
+    size_t close = 0;
+    bool dirty = false;
+    if (peek() == quote && index_.string_end(pos_, close, dirty) && !dirty) {
+      text = input_.substr(pos_ + 1, close - pos_ - 1);
+      pos_ = close + 1;
+      return true;
+    }
     if (get() != quote) {
       throw error("Expected string");
     }
-    std::string out;
+    std::string& out = scratch_;
+    out.clear();
     while (true) {
       char c = get();
       if (c == quote) {
@@ -223,51 +330,76 @@ class Parser {
         out.push_back(c);
       }
     }
-    return out;
+    text = out;
+    return false;
   }
 
-  double parse_number() {
+  static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  void skip_digits() {
+    while (pos_ < input_.size() && is_digit(input_[pos_])) {
+      ++pos_;
+    }
+  }
+
+  Json parse_number() {
     size_t start = pos_;
+    bool negative = false;
     if (peek() == '-') {
+      negative = true;
       ++pos_;
     }
+    // Accumulate the integer part while validating it; up to 19 digits cannot
+    // overflow uint64_t, which covers nearly every integer seen in practice.
+    uint64_t magnitude = 0;
+    size_t digits_start = pos_;
     if (peek() == '0') {
       ++pos_;
     } else {
-      if (!std::isdigit(static_cast<unsigned char>(peek()))) {
+      if (!is_digit(peek())) {
         throw error("Invalid number");
       }
-      while (std::isdigit(static_cast<unsigned char>(peek()))) {
+      while (pos_ < input_.size() && is_digit(input_[pos_])) {
+        magnitude = magnitude * 10 + static_cast<uint64_t>(input_[pos_] - '0');
         ++pos_;
       }
     }
+    bool integral = true;
     if (peek() == '.') {
+      integral = false;
       ++pos_;
-      if (!std::isdigit(static_cast<unsigned char>(peek()))) {
+      if (!is_digit(peek())) {
         throw error("Invalid number");
       }
-      while (std::isdigit(static_cast<unsigned char>(peek()))) {
-        ++pos_;
-      }
+      skip_digits();
     }
     if (peek() == 'e' || peek() == 'E') {
+      integral = false;
       ++pos_;
       if (peek() == '+' || peek() == '-') {
         ++pos_;
       }
-      if (!std::isdigit(static_cast<unsigned char>(peek()))) {
+      if (!is_digit(peek())) {
         throw error("Invalid number");
       }
-      while (std::isdigit(static_cast<unsigned char>(peek()))) {
-        ++pos_;
-      }
+      skip_digits();
     }
 
-    std::string num_str(input_.substr(start, pos_ - start));
-    char* end_ptr = nullptr;
-    errno = 0;
-    double value = std::strtod(num_str.c_str(), &end_ptr);
-    if (errno != 0 || end_ptr == num_str.c_str()) {
+    if (integral && pos_ - digits_start <= 19) {
+      if (!negative) {
+        return magnitude <= static_cast<uint64_t>(INT64_MAX) ? Json(static_cast<int64_t>(magnitude)) : Json(magnitude);
+      }
+      if (magnitude == 0) {
+        return Json(-0.0);
+      }
+      if (magnitude <= static_cast<uint64_t>(INT64_MAX) + 1) {
+        return Json(static_cast<int64_t>(0 - magnitude));
+      }
+    }
+    Json value;
+    if (!detail::parse_number_token(input_.substr(start, pos_ - start), integral, value)) {
       throw error("Invalid number");
     }
     return value;
@@ -278,7 +410,38 @@ class Parser {
   }
 };
 
+template <typename Int>
+int compare_int_double(Int i, double d) {
+  // Doubles at or beyond +-2^63 (or 2^64 for unsigned) are outside every
+  // integer's range; otherwise compare against the truncated double exactly.
+  constexpr double kUpper = std::is_signed_v<Int> ? 9223372036854775808.0 : 18446744073709551616.0;
+  constexpr double kLower = std::is_signed_v<Int> ? -9223372036854775808.0 : 0.0;
+  if (d >= kUpper) {
+    return -1;
+  }
+  if (d < kLower) {
+    return 1;
+  }
+  Int t = static_cast<Int>(d);
+  if (i != t) {
+    return i < t ? -1 : 1;
+  }
+  double frac = d - static_cast<double>(t);
+  return frac > 0 ? -1 : (frac < 0 ? 1 : 0);
+}
+
+template <typename T>
+int three_way(T a, T b) {
+  return a < b ? -1 : (b < a ? 1 : 0);
+}
+
 bool json_equal_impl(const Json& lhs, const Json& rhs) {
+  if (lhs.is_number() && rhs.is_number()) {
+    return compare_numbers(lhs, rhs) == 0;
+  }
+  if (lhs.is_string() && rhs.is_string()) {
+    return lhs.as_string() == rhs.as_string();
+  }
   if (lhs.value.index() != rhs.value.index()) {
     return false;
   }
@@ -288,12 +451,6 @@ bool json_equal_impl(const Json& lhs, const Json& rhs) {
   if (lhs.is_bool()) {
     return lhs.as_bool() == rhs.as_bool();
   }
-  if (lhs.is_number()) {
-    return lhs.as_number() == rhs.as_number();
-  }
-  if (lhs.is_string()) {
-    return lhs.as_string() == rhs.as_string();
-  }
   if (lhs.is_array()) {
     const auto& a = lhs.as_array();
     const auto& b = rhs.as_array();
@@ -324,15 +481,319 @@ bool json_equal_impl(const Json& lhs, const Json& rhs) {
   return true;
 }
 
+constexpr size_t kMaxInitialArena = size_t{64} << 20;
+
 }  // namespace
 
-Json parse_json(std::string_view input) {
-  Parser parser(input);
+JsonObject::JsonObject(const JsonObject& other)
+    : keys_(other.keys_), values_(other.values_), index_(other.index_) {
+  own_keys();
+}
+
+JsonObject& JsonObject::operator=(const JsonObject& other) {
+  if (this != &other) {
+    release_keys();
+    keys_ = other.keys_;
+    values_ = other.values_;
+    index_ = other.index_;
+    own_keys();
+  }
+  return *this;
+}
+
+JsonObject& JsonObject::operator=(JsonObject&& other) {
+  if (this != &other) {
+    release_keys();
+    bool same_resource = get_allocator() == other.get_allocator();
+    keys_ = std::move(other.keys_);
+    values_ = std::move(other.values_);
+    index_ = std::move(other.index_);
+    if (same_resource) {
+      other.keys_.clear();
+    } else {
+      own_keys();
+    }
+  }
+  return *this;
+}
+
+JsonObject::~JsonObject() {
+  release_keys();
+}
+
+std::shared_ptr<Json>& JsonObject::at(std::string_view key) {
+  size_t pos = find_index(key);
+  if (pos == size()) {
+    throw std::out_of_range("JsonObject::at: key not found");
+  }
+  return values_[pos];
+}
+
+const std::shared_ptr<Json>& JsonObject::at(std::string_view key) const {
+  size_t pos = find_index(key);
+  if (pos == size()) {
+    throw std::out_of_range("JsonObject::at: key not found");
+  }
+  return values_[pos];
+}
+
+std::shared_ptr<Json>& JsonObject::operator[](std::string_view key) {
+  size_t pos = find_index(key);
+  if (pos != size()) {
+    return values_[pos];
+  }
+  return (*insert_or_assign(key, nullptr).first).second;
+}
+
+std::pair<JsonObject::iterator, bool> JsonObject::insert_or_assign(std::string_view key, std::shared_ptr<Json> value) {
+  return insert_key(key, std::move(value), KeyStorage::Owned);
+}
+
+std::pair<JsonObject::iterator, bool> JsonObject::insert_or_assign_borrowed(std::string_view key,
+                                                                            std::shared_ptr<Json> value) {
+  return insert_key(key, std::move(value), KeyStorage::Borrowed);
+}
+
+std::pair<JsonObject::iterator, bool> JsonObject::insert_or_assign_interned(std::string_view key,
+                                                                            std::shared_ptr<Json> value) {
+  return insert_key(key, std::move(value), KeyStorage::Interned);
+}
+
+std::pair<JsonObject::iterator, bool> JsonObject::insert_key(std::string_view key, std::shared_ptr<Json> value,
+                                                             KeyStorage storage) {
+  size_t pos = find_index(key);
+  if (pos != size()) {
+    values_[pos] = std::move(value);
+    return {iterator(this, pos), false};
+  }
+  keys_.push_back(make_key(key, storage));
+  values_.push_back(std::move(value));
+  if (size() > kIndexThreshold) {
+    if (index_.size() < size() * 2) {
+      rebuild_index();
+    } else {
+      index_insert(pos, hash_key(key));
+    }
+  }
+  return {iterator(this, pos), true};
+}
+
+size_t JsonObject::erase(std::string_view key) {
+  size_t pos = find_index(key);
+  if (pos == size()) {
+    return 0;
+  }
+  erase(const_iterator(this, pos));
+  return 1;
+}
+
+JsonObject::iterator JsonObject::erase(const_iterator pos) {
+  size_t idx = pos.index();
+  if (size() > kIndexThreshold + 1) {
+    index_erase(idx);
+  } else {
+    index_.clear();
+  }
+  release_key(keys_[idx]);
+  keys_.erase(keys_.begin() + static_cast<std::ptrdiff_t>(idx));
+  values_.erase(values_.begin() + static_cast<std::ptrdiff_t>(idx));
+  return iterator(this, idx);
+}
+
+void JsonObject::clear() {
+  release_keys();
+  keys_.clear();
+  values_.clear();
+  index_.clear();
+}
+
+JsonKey JsonObject::make_key(std::string_view key, KeyStorage storage) {
+  if (key.size() > JsonKey::kMaxSize) {
+    throw std::length_error("JsonObject: key too long");
+  }
+  JsonKey result;
+  result.size_ = static_cast<uint32_t>(key.size());
+  if (key.size() <= JsonKey::kInlineSize) {
+    std::memcpy(result.storage_.small, key.data(), key.size());
+  } else if (storage != KeyStorage::Owned) {
+    result.storage_.ptr = key.data();
+    result.size_ |= storage == KeyStorage::Borrowed ? JsonKey::kBorrowed : JsonKey::kInterned;
+  } else {
+    char* chars = static_cast<char*>(get_allocator().resource()->allocate(key.size(), 1));
+    std::memcpy(chars, key.data(), key.size());
+    result.storage_.ptr = chars;
+  }
+  return result;
+}
+
+void JsonObject::release_key(JsonKey& key) {
+  if (key.allocated()) {
+    get_allocator().resource()->deallocate(const_cast<char*>(key.storage_.ptr), key.size(), 1);
+    key = JsonKey();
+  }
+}
+
+void JsonObject::reindex() {
+  if (size() > kIndexThreshold) {
+    rebuild_index();
+  } else {
+    index_.clear();
+  }
+}
+
+void JsonObject::release_keys() {
+  for (JsonKey& key : keys_) {
+    release_key(key);
+  }
+}
+
+// Gives this object its own copy of every allocated or interned key after its
+// key vector was copied from another object.
+void JsonObject::own_keys() {
+  std::pmr::memory_resource* resource = get_allocator().resource();
+  for (JsonKey& key : keys_) {
+    if (key.allocated() || key.interned()) {
+      char* chars = static_cast<char*>(resource->allocate(key.size(), 1));
+      std::memcpy(chars, key.storage_.ptr, key.size());
+      key.storage_.ptr = chars;
+      key.size_ &= ~JsonKey::kInterned;
+    }
+  }
+}
+
+size_t JsonObject::find_index(std::string_view key) const {
+  return find_index(key, index_.empty() ? 0 : hash_key(key));
+}
+
+size_t JsonObject::find_index(std::string_view key, size_t hash) const {
+  if (index_.empty()) {
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      if (keys_[i] == key) {
+        return i;
+      }
+    }
+    return size();
+  }
+  uint64_t tag = static_cast<uint64_t>(hash >> 32) << 32;
+  size_t mask = index_.size() - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint64_t entry = index_[slot];
+    if (entry == 0) {
+      return size();
+    }
+    if ((entry & 0xFFFFFFFF00000000ULL) == tag) {
+      size_t pos = static_cast<size_t>(entry & 0xFFFFFFFFULL) - 1;
+      if (keys_[pos] == key) {
+        return pos;
+      }
+    }
+  }
+}
+
+void JsonObject::index_insert(size_t pos, size_t hash) {
+  uint64_t entry = (static_cast<uint64_t>(hash >> 32) << 32) | static_cast<uint64_t>(pos + 1);
+  size_t mask = index_.size() - 1;
+  size_t slot = hash & mask;
+  while (index_[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  index_[slot] = entry;
+}
+
+// Empties the slot of the member at pos, then shifts later members of its
+// probe run back so none is left behind a gap, and renumbers the members
+// after pos. Only the keys of that run are hashed again.
+void JsonObject::index_erase(size_t pos) {
+  size_t mask = index_.size() - 1;
+  size_t hole = hash_key(keys_[pos]) & mask;
+  while (static_cast<size_t>(index_[hole] & 0xFFFFFFFFULL) != pos + 1) {
+    hole = (hole + 1) & mask;
+  }
+  for (size_t slot = (hole + 1) & mask; index_[slot] != 0; slot = (slot + 1) & mask) {
+    size_t home = hash_key(keys_[static_cast<size_t>(index_[slot] & 0xFFFFFFFFULL) - 1]) & mask;
+    if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+      index_[hole] = index_[slot];
+      hole = slot;
+    }
+  }
+  index_[hole] = 0;
+  for (uint64_t& entry : index_) {
+    if ((entry & 0xFFFFFFFFULL) > pos + 1) {
+      --entry;
+    }
+  }
+}
+
+void JsonObject::rebuild_index() {
+  size_t capacity = 32;
+  while (capacity < size() * 4) {
+    capacity <<= 1;
+  }
+  index_.assign(capacity, 0);
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    index_insert(i, hash_key(keys_[i]));
+  }
+}
+
+Document::Document() : Document(0) {}
+
+Document::Document(size_t initial_bytes)
+    : arena_(initial_bytes > 0 ? std::make_unique<std::pmr::monotonic_buffer_resource>(initial_bytes)
+                               : std::make_unique<std::pmr::monotonic_buffer_resource>()) {
+  root_ = new (arena_->allocate(sizeof(Json), alignof(Json))) Json(nullptr);
+}
+
+Json parse_json(std::string_view input, const ParseOptions& options) {
+  Parser parser(input, std::pmr::get_default_resource(), options);
   return parser.parse();
 }
 
+const Json& parse_json(std::string_view input, Document& document, const ParseOptions& options) {
+  // Size the first arena block from the input so typical documents fit in a
+  // handful of blocks (later blocks grow geometrically); the previous tree is
+  // only dropped once parsing succeeds.
+  Document parsed(std::min<size_t>(input.size() * 2 + 1024, kMaxInitialArena));
+  Parser parser(input, parsed.resource(), options, true);
+  Json value = parser.parse();
+  *parsed.root_ = std::move(value);
+  document = std::move(parsed);
+  return document.root();
+}
+
+const Json& parse_json_file(const std::string& path, Document& document, const ParseOptions& options) {
+  auto file = std::make_shared<detail::MappedFile>(path);
+  Document parsed;
+  parse_json(file->view(), parsed, options);
+  parsed.source_ = std::move(file);
+  document = std::move(parsed);
+  return document.root();
+}
+
 bool json_equal(const Json& lhs, const Json& rhs) {
   return json_equal_impl(lhs, rhs);
 }
 
+int compare_numbers(const Json& lhs, const Json& rhs) {
+  return std::visit(
+      [](auto a, auto b) -> int {
+        using A = decltype(a);
+        using B = decltype(b);
+        if constexpr (!std::is_arithmetic_v<A> || !std::is_arithmetic_v<B> || std::is_same_v<A, bool> ||
+                      std::is_same_v<B, bool>) {
+          throw std::runtime_error("compare_numbers requires numeric values");
+        } else if constexpr (std::is_same_v<A, B>) {
+          return three_way(a, b);
+        } else if constexpr (std::is_same_v<A, double>) {
+          return -compare_int_double(b, a);
+        } else if constexpr (std::is_same_v<B, double>) {
+          return compare_int_double(a, b);
+        } else if constexpr (std::is_same_v<A, int64_t>) {
+          return a < 0 ? -1 : three_way(static_cast<uint64_t>(a), b);
+        } else {
+          return b < 0 ? 1 : three_way(a, static_cast<uint64_t>(b));
+        }
+      },
+      lhs.value, rhs.value);
+}
+
 }  // namespace jsonpath
@@ -0,0 +1,154 @@
+#include "json_stream.hpp"
+
+#include "jsonpath/json.hpp"
+
+#include <utility>
+
+namespace jsonpath {
+namespace detail {
+namespace {
+
+bool is_ws(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+}  // namespace
+
+JsonStreamReader::JsonStreamReader(Source source, size_t chunk_size)
+    : source_(std::move(source)), chunk_size_(chunk_size > 0 ? chunk_size : kChunkSize),
+      buffer_(new char[chunk_size_]) {}
+
+bool JsonStreamReader::refill() {
+  if (capture_) {
+    capture_->append(buffer_.get() + mark_, size_ - mark_);
+    mark_ = 0;
+  }
+  consumed_ += size_;
+  pos_ = 0;
+  size_ = source_(buffer_.get(), chunk_size_);
+  return size_ > 0;
+}
+
+void JsonStreamReader::skip_ws() {
+  while (peek() != '\0' && is_ws(buffer_[pos_])) {
+    ++pos_;
+  }
+}
+
+void JsonStreamReader::expect(char c, const char* message) {
+  if (peek() != c) {
+    throw error(message);
+  }
+  ++pos_;
+}
+
+std::string_view JsonStreamReader::read_key() {
+  if (peek() != '"') {
+    throw error("Expected string key");
+  }
+  key_.clear();
+  capture_value(key_);
+  if (key_.find('\\') == std::string::npos) {
+    return std::string_view(key_).substr(1, key_.size() - 2);
+  }
+  key_ = std::string(parse_json(key_).as_string());
+  return key_;
+}
+
+void JsonStreamReader::skip_value() {
+  skip_ws();
+  scan_value();
+}
+
+void JsonStreamReader::capture_value(std::string& out) {
+  skip_ws();
+  capture_ = &out;
+  mark_ = pos_;
+  try {
+    scan_value();
+  } catch (...) {
+    capture_ = nullptr;
+    throw;
+  }
+  out.append(buffer_.get() + mark_, pos_ - mark_);
+  capture_ = nullptr;
+}
+
+std::runtime_error JsonStreamReader::error(const char* message) const {
+  return std::runtime_error(std::string(message) + " at position " + std::to_string(position()));
+}
+
+void JsonStreamReader::scan_value() {
+  char c = peek();
+  if (c == '"') {
+    scan_string();
+    return;
+  }
+  if (c == '{' || c == '[') {
+    scan_container();
+    return;
+  }
+  size_t length = 0;
+  while (true) {
+    c = peek();
+    if (c == '\0' || is_ws(c) || c == ',' || c == ']' || c == '}') {
+      break;
+    }
+    ++pos_;
+    ++length;
+  }
+  if (length == 0) {
+    throw error("Invalid JSON value");
+  }
+}
+
+void JsonStreamReader::scan_string() {
+  ++pos_;
+  while (true) {
+    if (pos_ == size_ && !refill()) {
+      throw error("Unterminated string");
+    }
+    const char* p = buffer_.get() + pos_;
+    const char* end = buffer_.get() + size_;
+    while (p < end && *p != '"' && *p != '\\') {
+      ++p;
+    }
+    pos_ = static_cast<size_t>(p - buffer_.get());
+    if (p == end) {
+      continue;
+    }
+    ++pos_;
+    if (*p == '"') {
+      return;
+    }
+    if (pos_ == size_ && !refill()) {
+      throw error("Unterminated string");
+    }
+    ++pos_;
+  }
+}
+
+void JsonStreamReader::scan_container() {
+  size_t depth = 0;
+  while (true) {
+    if (pos_ == size_ && !refill()) {
+      throw error("Unexpected end of input");
+    }
+    char c = buffer_[pos_];
+    if (c == '"') {
+      scan_string();
+      continue;
+    }
+    ++pos_;
+    if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      if (--depth == 0) {
+        return;
+      }
+    }
+  }
+}
+
+}  // namespace detail
+}  // namespace jsonpath
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace jsonpath {
+namespace detail {
+
+// Forward-only tokenizer over JSON pulled from a source in chunks. Only one
+// chunk is held at a time; values are either skipped (checking just string
+// and bracket structure) or captured as raw text for the full parser, so
+// memory stays bounded by the largest captured value.
+class JsonStreamReader {
+ public:
+  // Fills buffer with up to capacity bytes and returns the count; 0 means end
+  // of input.
+  using Source = std::function<size_t(char* buffer, size_t capacity)>;
+
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  explicit JsonStreamReader(Source source, size_t chunk_size = kChunkSize);
+
+  // Next byte without consuming it, or '\0' at end of input.
+  char peek() {
+    if (pos_ == size_ && !refill()) {
+      return '\0';
+    }
+    return buffer_[pos_];
+  }
+
+  bool at_end() { return pos_ == size_ && !refill(); }
+
+  void skip_ws();
+  // Consumes c or throws message.
+  void expect(char c, const char* message);
+  // Reads a member name; the view is valid until the next read_key call.
+  std::string_view read_key();
+  void skip_value();
+  // Appends the raw text of the next value to out.
+  void capture_value(std::string& out);
+
+  size_t position() const { return consumed_ + pos_; }
+  std::runtime_error error(const char* message) const;
+
+ private:
+  Source source_;
+  size_t chunk_size_;
+  std::unique_ptr<char[]> buffer_;
+  size_t pos_ = 0;
+  size_t size_ = 0;
+  size_t consumed_ = 0;
+  // Active capture: bytes from mark_ onwards are appended before a refill.
+  std::string* capture_ = nullptr;
+  size_t mark_ = 0;
+  std::string key_;
+
+  bool refill();
+  void scan_value();
+  void scan_string();
+  void scan_container();
+};
+
+}  // namespace detail
+}  // namespace jsonpath
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "jsonpath/json.hpp"
+#include "jsonpath/serialize.hpp"
+
+namespace jsonpath {
+namespace detail {
+
+// Writes JSON to a sink either a whole value at a time or piece by piece,
+// taking care of separators and, when pretty, indentation. Whole values
+// are written recursively without the per-piece bookkeeping.
+class JsonWriter {
+ public:
+  JsonWriter(Sink& sink, const SerializeOptions& options) : sink_(sink), options_(options) {}
+
+  void value(const Json& value);
+  // Text that is already valid JSON, copied as is.
+  void raw_value(std::string_view text);
+
+  void begin_array();
+  void end_array();
+  void begin_object();
+  void end_object();
+  // A member name, escaped as needed; raw_key takes the name with its
+  // quotes, already escaped.
+  void key(std::string_view name);
+  void raw_key(std::string_view quoted);
+
+ private:
+  Sink& sink_;
+  const SerializeOptions& options_;
+  size_t depth_ = 0;
+  bool first_ = true;
+  bool after_key_ = false;
+
+  void separate();
+  void close(char bracket);
+  void write(const Json& value, size_t depth);
+  void write_double(double d);
+  void write_string(std::string_view s);
+  void newline(size_t depth);
+  void write_array(const Json::Array& array, size_t depth);
+  void write_object(const Json::Object& object, size_t depth);
+};
+
+}  // namespace detail
+}  // namespace jsonpath
@@ -1,4 +1,12 @@
 #include "jsonpath/jsonpath.hpp"
+#include "jsonpath/cache.hpp"
+
+#include "jsonpath/function.hpp"
+
+#include "iregexp.hpp"
+#include "mapped_file.hpp"
+#include "number_parse.hpp"
+#include "query.hpp"
 
 #include <algorithm>
 #include <cctype>
@@ -6,95 +14,388 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
 #include <optional>
 #include <regex>
 #include <stdexcept>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 
 namespace jsonpath {
+namespace detail {
+
+struct PathArena {
+  struct Frame {
+    const std::shared_ptr<Json>* begin;
+    const std::shared_ptr<Json>* next;
+    const std::shared_ptr<Json>* end;
+    const Json* container;
+    // Step for the child last taken from this frame, once something needs it.
+    const PathStep* step;
+  };
+
+  const PathStep* add(const PathStep* parent, const Json* container, size_t position) {
+    steps.push_back({parent, container, position});
+    return &steps.back();
+  }
+
+  std::deque<PathStep> steps;
+  std::vector<Frame> frames;
+};
+
+}  // namespace detail
+
 namespace {
 
 constexpr int64_t kMaxIndex = 9007199254740991LL;  // 2^53 - 1
 
-struct Slice {
-  std::optional<int64_t> start;
-  std::optional<int64_t> end;
-  std::optional<int64_t> step;
-};
-
-struct Expr;
+using detail::Comparable;
+using detail::CompareOp;
+using detail::EvalContext;
+using detail::Expr;
+using detail::FilterProgram;
+using detail::FunctionExpr;
+using detail::HoistedValue;
+using detail::Literal;
+using detail::NodeList;
+using detail::Query;
+using detail::RawNodes;
+using detail::RawScanner;
+using detail::RawSpan;
+using detail::ScopedNodeList;
+using detail::Segment;
+using detail::Selector;
+using detail::Slice;
+using detail::TestItem;
+
+// Pattern for match() or search(). The I-Regexp DFA handles most patterns;
+// anything it rejects goes to std::regex so existing ECMAScript patterns keep
+// working. A pattern neither accepts never matches.
+class CompiledRegex {
+ public:
+  CompiledRegex(std::string_view pattern, bool search) : search_(search) {
+    fast_ = detail::IRegexp::compile(pattern, search);
+    if (!fast_) {
+      try {
+        fallback_.emplace(pattern.begin(), pattern.end(), std::regex::ECMAScript);
+      } catch (const std::regex_error&) {
+      }
+    }
+  }
 
-struct Selector {
-  struct Name { std::string value; };
-  struct Wildcard {};
-  struct Index { int64_t value; };
-  struct SliceSel { Slice value; };
-  struct Filter { std::unique_ptr<Expr> expr; };
+  bool matches(std::string_view subject) const {
+    if (fast_) {
+      return fast_->matches(subject);
+    }
+    if (!fallback_) {
+      return false;
+    }
+    if (search_) {
+      return std::regex_search(subject.begin(), subject.end(), *fallback_);
+    }
+    return std::regex_match(subject.begin(), subject.end(), *fallback_);
+  }
 
-  std::variant<Name, Wildcard, Index, SliceSel, Filter> node;
+ private:
+  std::unique_ptr<detail::IRegexp> fast_;
+  std::optional<std::regex> fallback_;
+  bool search_;
 };
 
-struct Segment {
-  bool descendant = false;
-  std::vector<Selector> selectors;
-};
+// Patterns that only exist at evaluation time (taken from the document) are
+// compiled once per thread and kept in a small LRU.
+class RegexCache {
+ public:
+  static constexpr size_t kCapacity = 64;
+
+  const CompiledRegex& get(std::string_view pattern, bool search) {
+    key_.assign(1, search ? 's' : 'm');
+    key_.append(pattern);
+    auto it = index_.find(key_);
+    if (it != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return entries_.front().second;
+    }
+    if (entries_.size() == kCapacity) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(std::piecewise_construct, std::forward_as_tuple(key_),
+                           std::forward_as_tuple(pattern, search));
+    index_.emplace(key_, entries_.begin());
+    return entries_.front().second;
+  }
 
-struct Query {
-  bool absolute = true;
-  bool singular = true;
-  std::vector<Segment> segments;
+ private:
+  std::list<std::pair<std::string, CompiledRegex>> entries_;
+  std::unordered_map<std::string, std::list<std::pair<std::string, CompiledRegex>>::iterator> index_;
+  std::string key_;
 };
 
-struct Literal {
-  Json value;
-};
+enum class FnReturn { Value, Logical };
 
-struct FunctionExpr;
+enum class ParamType { Value, Nodes, Logical };
 
-struct Comparable {
-  std::variant<Literal, Query, std::unique_ptr<FunctionExpr>> node;
-};
+struct FunctionResult;
 
-enum class CompareOp {
-  Eq,
-  Ne,
-  Lt,
-  Lte,
-  Gt,
-  Gte,
-};
+using FunctionImpl = FunctionResult (*)(const FunctionExpr& func, const EvalContext& ctx);
 
-struct TestItem {
-  std::variant<Query, std::unique_ptr<FunctionExpr>> node;
+struct FunctionSignature {
+  FnReturn ret;
+  std::vector<ParamType> params;
 };
 
-struct Expr {
-  struct Or { std::unique_ptr<Expr> left; std::unique_ptr<Expr> right; };
-  struct And { std::unique_ptr<Expr> left; std::unique_ptr<Expr> right; };
-  struct Not { std::unique_ptr<Expr> expr; };
-  struct Comparison { Comparable left; CompareOp op; Comparable right; };
-  struct Test { TestItem item; };
+struct BuiltinFunction {
+  const char* name;
+  FunctionSignature signature;
+  FunctionImpl impl;
+};
 
-  std::variant<Or, And, Not, Comparison, Test> node;
+struct CustomFunction {
+  FunctionSignature signature;
+  Function impl;
 };
 
-enum class FnReturn { Value, Logical };
+using FunctionArgExpr = std::variant<Literal, Query, std::unique_ptr<FunctionExpr>, std::unique_ptr<Expr>>;
 
-enum class ParamType { Value, Nodes, Logical };
+}  // namespace
 
-struct FunctionExpr {
+// Resolved when the query is parsed: impl is called directly for every
+// candidate node, and each argument already has the form its parameter type
+// requires (Nodes and Logical parameters always hold a Query and an Expr).
+struct detail::FunctionExpr {
   std::string name;
   FnReturn ret;
   std::vector<ParamType> params;
-  std::vector<std::variant<Literal, Query, std::unique_ptr<FunctionExpr>, std::unique_ptr<Expr>>> args;
+  std::vector<FunctionArgExpr> args;
+  FunctionImpl impl = nullptr;
+  std::shared_ptr<const CustomFunction> custom;
+  // match() and search() with a literal pattern, compiled with the query.
+  std::unique_ptr<const CompiledRegex> regex;
+};
+
+namespace {
+
+FunctionResult call_length(const FunctionExpr& func, const EvalContext& ctx);
+FunctionResult call_count(const FunctionExpr& func, const EvalContext& ctx);
+FunctionResult call_match(const FunctionExpr& func, const EvalContext& ctx);
+FunctionResult call_search(const FunctionExpr& func, const EvalContext& ctx);
+FunctionResult call_value(const FunctionExpr& func, const EvalContext& ctx);
+FunctionResult call_custom(const FunctionExpr& func, const EvalContext& ctx);
+
+const BuiltinFunction* find_builtin(std::string_view name) {
+  static const BuiltinFunction kBuiltins[] = {
+      {"length", {FnReturn::Value, {ParamType::Value}}, call_length},
+      {"count", {FnReturn::Value, {ParamType::Nodes}}, call_count},
+      {"match", {FnReturn::Logical, {ParamType::Value, ParamType::Value}}, call_match},
+      {"search", {FnReturn::Logical, {ParamType::Value, ParamType::Value}}, call_search},
+      {"value", {FnReturn::Value, {ParamType::Nodes}}, call_value},
+  };
+  for (const BuiltinFunction& builtin : kBuiltins) {
+    if (name == builtin.name) {
+      return &builtin;
+    }
+  }
+  return nullptr;
+}
+
+struct FunctionRegistry {
+  std::mutex mutex;
+  std::unordered_map<std::string, std::shared_ptr<const CustomFunction>> functions;
 };
 
+FunctionRegistry& function_registry() {
+  static FunctionRegistry registry;
+  return registry;
+}
+
+std::shared_ptr<const CustomFunction> find_custom_function(const std::string& name) {
+  FunctionRegistry& registry = function_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto it = registry.functions.find(name);
+  return it == registry.functions.end() ? nullptr : it->second;
+}
+
 struct ParseError : std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+bool compare_nodes(const Json* lhs, const Json* rhs, CompareOp op);
+bool function_uses_root(const FunctionExpr& func);
+bool expr_is_constant(const Expr& expr);
+
+// True if func gives the same result for every candidate: a built-in whose
+// arguments do not refer to @. Custom functions may have side effects and
+// are always called per candidate.
+bool function_is_constant(const FunctionExpr& func) {
+  if (func.custom) {
+    return false;
+  }
+  for (const auto& arg : func.args) {
+    if (const auto* query = std::get_if<Query>(&arg)) {
+      if (!query->absolute) {
+        return false;
+      }
+    } else if (const auto* fn = std::get_if<std::unique_ptr<FunctionExpr>>(&arg)) {
+      if (!function_is_constant(**fn)) {
+        return false;
+      }
+    } else if (const auto* logical = std::get_if<std::unique_ptr<Expr>>(&arg)) {
+      if (!expr_is_constant(**logical)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool comparable_is_constant(const Comparable& comp) {
+  if (const auto* query = std::get_if<Query>(&comp.node)) {
+    return query->absolute;
+  }
+  if (const auto* fn = std::get_if<std::unique_ptr<FunctionExpr>>(&comp.node)) {
+    return function_is_constant(**fn);
+  }
+  return true;
+}
+
+bool expr_is_constant(const Expr& expr) {
+  if (const auto* node = std::get_if<Expr::Or>(&expr.node)) {
+    return expr_is_constant(*node->left) && expr_is_constant(*node->right);
+  }
+  if (const auto* node = std::get_if<Expr::And>(&expr.node)) {
+    return expr_is_constant(*node->left) && expr_is_constant(*node->right);
+  }
+  if (const auto* node = std::get_if<Expr::Not>(&expr.node)) {
+    return expr_is_constant(*node->expr);
+  }
+  if (const auto* node = std::get_if<Expr::Comparison>(&expr.node)) {
+    return comparable_is_constant(node->left) && comparable_is_constant(node->right);
+  }
+  const auto& item = std::get<Expr::Test>(expr.node).item;
+  if (const auto* query = std::get_if<Query>(&item.node)) {
+    return query->absolute;
+  }
+  return function_is_constant(*std::get<std::unique_ptr<FunctionExpr>>(item.node));
+}
+
+// Moves operand to the hoisted table if it only depends on the root. Those
+// that need neither the root nor @ (built-ins over literals) are left
+// alone, so that filters the raw and streaming evaluators accept, which
+// never refer to the root, never have hoisted operands.
+FilterProgram::Operand hoist_operand(FilterProgram::Operand operand, bool test, FilterProgram& program) {
+  bool hoist = false;
+  switch (operand.source) {
+    case FilterProgram::Source::Path:
+      hoist = program.paths[operand.index].absolute;
+      break;
+    case FilterProgram::Source::Query:
+      hoist = program.queries[operand.index]->absolute;
+      break;
+    case FilterProgram::Source::Function: {
+      const FunctionExpr& func = *program.functions[operand.index];
+      hoist = function_is_constant(func) && function_uses_root(func);
+      break;
+    }
+    default:
+      break;
+  }
+  if (!hoist) {
+    return operand;
+  }
+  program.hoisted.emplace_back(operand, test);
+  return {static_cast<uint32_t>(program.hoisted.size() - 1), FilterProgram::Source::Hoisted};
+}
+
+FilterProgram::Operand filter_query_operand(const Query& query, FilterProgram& program) {
+  if (!query.singular) {
+    program.queries.push_back(&query);
+    return {static_cast<uint32_t>(program.queries.size() - 1), FilterProgram::Source::Query};
+  }
+  FilterProgram::Path path{static_cast<uint32_t>(program.steps.size()), 0, query.absolute};
+  for (const Segment& segment : query.segments) {
+    const Selector& selector = segment.selectors.front();
+    if (const auto* name = std::get_if<Selector::Name>(&selector.node)) {
+      program.steps.push_back({name->value, name->hash, 0, true});
+    } else {
+      program.steps.push_back({{}, 0, std::get<Selector::Index>(selector.node).value, false});
+    }
+  }
+  path.count = static_cast<uint32_t>(program.steps.size() - path.first);
+  program.paths.push_back(path);
+  return {static_cast<uint32_t>(program.paths.size() - 1), FilterProgram::Source::Path};
+}
+
+FilterProgram::Operand filter_function_operand(const FunctionExpr& func, FilterProgram& program) {
+  program.functions.push_back(&func);
+  return {static_cast<uint32_t>(program.functions.size() - 1), FilterProgram::Source::Function};
+}
+
+FilterProgram::Operand filter_operand(const Comparable& comp, FilterProgram& program) {
+  if (const auto* literal = std::get_if<Literal>(&comp.node)) {
+    program.literals.push_back(&literal->value);
+    return {static_cast<uint32_t>(program.literals.size() - 1), FilterProgram::Source::Literal};
+  }
+  if (const auto* query = std::get_if<Query>(&comp.node)) {
+    return filter_query_operand(*query, program);
+  }
+  return filter_function_operand(*std::get<std::unique_ptr<FunctionExpr>>(comp.node), program);
+}
+
+void lower_filter(const Expr& expr, FilterProgram& program) {
+  using Op = FilterProgram::Op;
+  auto jump_over = [&](Op op, const Expr& left, const Expr& right) {
+    lower_filter(left, program);
+    size_t jump = program.code.size();
+    program.code.push_back({{}, {}, op, CompareOp::Eq});
+    lower_filter(right, program);
+    program.code[jump].right.index = static_cast<uint32_t>(program.code.size());
+  };
+  if (const auto* node = std::get_if<Expr::Or>(&expr.node)) {
+    jump_over(Op::JumpIfTrue, *node->left, *node->right);
+  } else if (const auto* node = std::get_if<Expr::And>(&expr.node)) {
+    jump_over(Op::JumpIfFalse, *node->left, *node->right);
+  } else if (const auto* node = std::get_if<Expr::Not>(&expr.node)) {
+    lower_filter(*node->expr, program);
+    program.code.push_back({{}, {}, Op::Not, CompareOp::Eq});
+  } else if (const auto* node = std::get_if<Expr::Comparison>(&expr.node)) {
+    const auto* left_literal = std::get_if<Literal>(&node->left.node);
+    const auto* right_literal = std::get_if<Literal>(&node->right.node);
+    if (left_literal && right_literal) {
+      bool result = compare_nodes(&left_literal->value, &right_literal->value, node->op);
+      program.code.push_back({{result ? 1u : 0u, {}}, {}, Op::Constant, CompareOp::Eq});
+      return;
+    }
+    FilterProgram::Operand left = hoist_operand(filter_operand(node->left, program), false, program);
+    FilterProgram::Operand right = hoist_operand(filter_operand(node->right, program), false, program);
+    program.code.push_back({left, right, Op::Compare, node->op});
+  } else {
+    const TestItem& item = std::get<Expr::Test>(expr.node).item;
+    FilterProgram::Operand operand = std::holds_alternative<Query>(item.node)
+                                         ? filter_query_operand(std::get<Query>(item.node), program)
+                                         : filter_function_operand(*std::get<std::unique_ptr<FunctionExpr>>(item.node),
+                                                                   program);
+    program.code.push_back({hoist_operand(operand, true, program), {}, Op::Test, CompareOp::Eq});
+  }
+}
+
+FilterProgram compile_filter(const Expr& expr) {
+  FilterProgram program;
+  lower_filter(expr, program);
+  return program;
+}
+
+Selector name_selector(std::string name) {
+  size_t hash = JsonObject::hash_key(name);
+  return Selector{Selector::Name{std::move(name), hash}};
+}
+
 class JsonPathParser {
  public:
   explicit JsonPathParser(std::string_view input) : input_(input) {}
@@ -123,9 +424,15 @@ class JsonPathParser {
     }
   }
 
+  // Filter programs with hoisted operands among all those parsed so far.
+  size_t hoisted_runs() const { return hoisted_runs_; }
+  size_t hoisted_values() const { return hoisted_values_; }
+
  private:
   std::string_view input_;
   size_t pos_ = 0;
+  size_t hoisted_runs_ = 0;
+  size_t hoisted_values_ = 0;
 
   char peek() const {
     if (pos_ >= input_.size()) {
@@ -215,7 +522,7 @@ class JsonPathParser {
       return;
     }
     std::string name = parse_member_name_shorthand();
-    segment.selectors.push_back(Selector{Selector::Name{std::move(name)}});
+    segment.selectors.push_back(name_selector(std::move(name)));
     query.segments.push_back(std::move(segment));
   }
 
@@ -237,7 +544,7 @@ class JsonPathParser {
       return;
     }
     std::string name = parse_member_name_shorthand();
-    segment.selectors.push_back(Selector{Selector::Name{std::move(name)}});
+    segment.selectors.push_back(name_selector(std::move(name)));
     query.segments.push_back(std::move(segment));
   }
 
@@ -266,14 +573,19 @@ class JsonPathParser {
         get();
         auto expr = parse_logical_expr();
         query.singular = false;
-        segment.selectors.push_back(Selector{Selector::Filter{std::move(expr)}});
+        FilterProgram program = compile_filter(*expr);
+        if (!program.hoisted.empty()) {
+          ++hoisted_runs_;
+          hoisted_values_ += program.hoisted.size();
+        }
+        segment.selectors.push_back(Selector{Selector::Filter{std::move(expr), std::move(program)}});
       } else if (peek() == '*') {
         get();
         query.singular = false;
         segment.selectors.push_back(Selector{Selector::Wildcard{}});
       } else if (peek() == '\'' || peek() == '"') {
         std::string name = parse_string_literal();
-        segment.selectors.push_back(Selector{Selector::Name{std::move(name)}});
+        segment.selectors.push_back(name_selector(std::move(name)));
       } else if (peek() == ':' || peek() == '-' || std::isdigit(static_cast<unsigned char>(peek()))) {
         Selector sel = parse_index_or_slice();
         if (!std::holds_alternative<Selector::Index>(sel.node)) {
@@ -470,6 +782,23 @@ class JsonPathParser {
     return Selector{Selector::Index{*start}};
   }
 
+  // true, false and null only count as literals when they are not the start
+  // of a longer function name.
+  bool at_literal() {
+    char c = peek();
+    if (c == '\'' || c == '"' || c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+      return true;
+    }
+    for (std::string_view keyword : {"true", "false", "null"}) {
+      if (input_.substr(pos_, keyword.size()) == keyword) {
+        size_t end = pos_ + keyword.size();
+        char next = end < input_.size() ? input_[end] : '\0';
+        return !std::isalnum(static_cast<unsigned char>(next)) && next != '_';
+      }
+    }
+    return false;
+  }
+
   Literal parse_literal() {
     skip_ws();
     char c = peek();
@@ -492,12 +821,12 @@ class JsonPathParser {
       }
     }
     if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
-      return Literal{Json(parse_number_literal())};
+      return Literal{parse_number_literal()};
     }
     throw error("Invalid literal");
   }
 
-  double parse_number_literal() {
+  Json parse_number_literal() {
     skip_ws();
     size_t start = pos_;
     if (peek() == '-') {
@@ -513,7 +842,9 @@ class JsonPathParser {
         ++pos_;
       }
     }
+    bool integral = true;
     if (peek() == '.') {
+      integral = false;
       ++pos_;
       if (!std::isdigit(static_cast<unsigned char>(peek()))) {
         throw error("Invalid number");
@@ -523,6 +854,7 @@ class JsonPathParser {
       }
     }
     if (peek() == 'e' || peek() == 'E') {
+      integral = false;
       ++pos_;
       if (peek() == '+' || peek() == '-') {
         ++pos_;
@@ -534,10 +866,8 @@ class JsonPathParser {
         ++pos_;
       }
     }
-    std::string num_str(input_.substr(start, pos_ - start));
-    char* end_ptr = nullptr;
-    double value = std::strtod(num_str.c_str(), &end_ptr);
-    if (end_ptr == num_str.c_str()) {
+    Json value;
+    if (!detail::parse_number_token(input_.substr(start, pos_ - start), integral, value)) {
       throw error("Invalid number");
     }
     return value;
@@ -563,21 +893,14 @@ class JsonPathParser {
 
     auto func = std::make_unique<FunctionExpr>();
     func->name = name;
-    if (name == "length") {
-      func->ret = FnReturn::Value;
-      func->params = {ParamType::Value};
-    } else if (name == "count") {
-      func->ret = FnReturn::Value;
-      func->params = {ParamType::Nodes};
-    } else if (name == "match") {
-      func->ret = FnReturn::Logical;
-      func->params = {ParamType::Value, ParamType::Value};
-    } else if (name == "search") {
-      func->ret = FnReturn::Logical;
-      func->params = {ParamType::Value, ParamType::Value};
-    } else if (name == "value") {
-      func->ret = FnReturn::Value;
-      func->params = {ParamType::Nodes};
+    if (const BuiltinFunction* builtin = find_builtin(name)) {
+      func->ret = builtin->signature.ret;
+      func->params = builtin->signature.params;
+      func->impl = builtin->impl;
+    } else if ((func->custom = find_custom_function(name))) {
+      func->ret = func->custom->signature.ret;
+      func->params = func->custom->signature.params;
+      func->impl = call_custom;
     } else {
       throw error("Unknown function");
     }
@@ -609,6 +932,13 @@ class JsonPathParser {
       throw error("Incorrect argument count");
     }
 
+    if ((func->impl == call_match || func->impl == call_search) && std::holds_alternative<Literal>(func->args[1])) {
+      const Json& pattern = std::get<Literal>(func->args[1]).value;
+      if (pattern.is_string()) {
+        func->regex = std::make_unique<const CompiledRegex>(pattern.as_string(), func->impl == call_search);
+      }
+    }
+
     return func;
   }
 
@@ -621,7 +951,7 @@ class JsonPathParser {
     }
     if (param == ParamType::Value) {
       char c = peek();
-      if (c == '\'' || c == '"' || c == '-' || std::isdigit(static_cast<unsigned char>(c)) || c == 't' || c == 'f' || c == 'n') {
+      if (at_literal()) {
         return parse_literal();
       }
       if (c == '$' || c == '@') {
@@ -653,7 +983,7 @@ class JsonPathParser {
   Comparable parse_comparable() {
     skip_ws();
     char c = peek();
-    if (c == '\'' || c == '"' || c == '-' || std::isdigit(static_cast<unsigned char>(c)) || c == 't' || c == 'f' || c == 'n') {
+    if (at_literal()) {
       return Comparable{parse_literal()};
     }
     if (c == '$' || c == '@') {
@@ -746,7 +1076,7 @@ class JsonPathParser {
   std::unique_ptr<Expr> parse_test_or_comparison() {
     skip_ws();
     char c = peek();
-    if (c == '\'' || c == '"' || c == '-' || std::isdigit(static_cast<unsigned char>(c)) || c == 't' || c == 'f' || c == 'n') {
+    if (at_literal()) {
       Comparable left = parse_comparable();
       CompareOp op = parse_compare_op();
       Comparable right = parse_comparable();
@@ -843,12 +1173,27 @@ struct ValueResult {
   }
 };
 
-struct EvalContext {
-  const Json* root = nullptr;
-  const Json* current = nullptr;
+}  // namespace
+
+// A hoisted filter operand: its value (nullptr for Nothing) or, if tested,
+// its result.
+struct detail::HoistedValue {
+  const Json* value = nullptr;
+  bool logical = false;
+  ValueResult storage;
 };
 
-using NodeList = std::vector<const Json*>;
+detail::EvalBuffers::EvalBuffers() = default;
+detail::EvalBuffers::~EvalBuffers() = default;
+
+void detail::EvalBuffers::reset_hoisted(size_t runs, size_t values) {
+  hoisted_runs.clear();
+  hoisted.clear();
+  hoisted_runs.reserve(runs);
+  hoisted.reserve(values);
+}
+
+namespace {
 
 ValueResult make_literal(Json value) {
   ValueResult res;
@@ -876,164 +1221,346 @@ int64_t clamp_int64(int64_t value, int64_t min_value, int64_t max_value) {
   return std::max(min_value, std::min(value, max_value));
 }
 
-void collect_descendants(const Json* node, NodeList& out) {
-  out.push_back(node);
-  if (node->is_array()) {
-    for (const auto& child : node->as_array()) {
-      collect_descendants(child.get(), out);
+// Calls emit with each array index selected by slice, in selection order,
+// until emit returns false. Returns false if it stopped early.
+template <typename Emit>
+bool for_each_slice_index(const Slice& slice, int64_t size, Emit emit) {
+  int64_t step = slice.step.value_or(1);
+  if (step == 0) {
+    return true;
+  }
+  auto normalize = [&](int64_t idx) {
+    return idx >= 0 ? idx : size + idx;
+  };
+  int64_t start = slice.start.has_value() ? normalize(*slice.start) : (step > 0 ? 0 : size - 1);
+  int64_t end = slice.end.has_value() ? normalize(*slice.end) : (step > 0 ? size : -1);
+
+  if (step > 0) {
+    start = clamp_int64(start, 0, size);
+    end = clamp_int64(end, 0, size);
+    for (int64_t i = start; i < end; i += step) {
+      if (!emit(static_cast<size_t>(i))) {
+        return false;
+      }
     }
-  } else if (node->is_object()) {
-    for (const auto& [key, child] : node->as_object()) {
-      (void)key;
-      collect_descendants(child.get(), out);
+  } else {
+    start = clamp_int64(start, -1, size - 1);
+    end = clamp_int64(end, -1, size - 1);
+    for (int64_t i = start; i > end; i += step) {
+      if (!emit(static_cast<size_t>(i))) {
+        return false;
+      }
     }
   }
+  return true;
 }
 
-NodeList eval_query(const Query& query, const Json* root, const Json* start);
+const std::pmr::vector<std::shared_ptr<Json>>* children_of(const Json* node) {
+  if (node->is_array()) {
+    return &node->as_array();
+  }
+  if (node->is_object()) {
+    return &node->as_object().values();
+  }
+  return nullptr;
+}
 
-bool eval_expr(const Expr& expr, const EvalContext& ctx);
+// Calls visit on node and then on every node below it, in document order,
+// until visit returns false. Returns false if it stopped early. The stack
+// holds the unvisited siblings at each level, so memory grows with depth
+// rather than size and deep documents cannot exhaust the call stack.
+template <typename Visit>
+bool for_each_descendant(const Json* node, std::vector<detail::EvalBuffers::Frame>& stack, Visit&& visit) {
+  size_t base = stack.size();
+  while (true) {
+    if (!visit(node)) {
+      stack.resize(base);
+      return false;
+    }
+    const auto* children = children_of(node);
+    if (children && !children->empty()) {
+      stack.push_back({children->data(), children->data() + children->size()});
+    }
+    while (stack.size() > base && stack.back().next == stack.back().end) {
+      stack.pop_back();
+    }
+    if (stack.size() == base) {
+      return true;
+    }
+    node = (stack.back().next++)->get();
+  }
+}
 
-NodeList apply_selector(const Selector& selector, const Json* node, const EvalContext& ctx) {
-  NodeList out;
-  if (std::holds_alternative<Selector::Name>(selector.node)) {
+bool eval_expr(const Expr& expr, const EvalContext& ctx);
+const HoistedValue* hoisted_values(const FilterProgram& program, const EvalContext& ctx);
+
+// Calls emit(child, position) with each node selector picks from node, in
+// order, until emit returns false; position is the child's index in the array
+// or member order of node. Returns false if it stopped early.
+template <typename Emit>
+bool for_each_selected(const Selector& selector, const Json* node, const EvalContext& ctx, Emit&& emit) {
+  if (const auto* name = std::get_if<Selector::Name>(&selector.node)) {
     if (!node->is_object()) {
-      return out;
+      return true;
     }
-    const auto& name = std::get<Selector::Name>(selector.node).value;
     const auto& obj = node->as_object();
-    auto it = obj.find(name);
-    if (it != obj.end()) {
-      out.push_back(it->second.get());
-    }
-    return out;
+    auto it = obj.find(name->value, name->hash);
+    return it == obj.end() || emit(it->second.get(), it.index());
   }
   if (std::holds_alternative<Selector::Wildcard>(selector.node)) {
-    if (node->is_array()) {
-      for (const auto& child : node->as_array()) {
-        out.push_back(child.get());
-      }
-    } else if (node->is_object()) {
-      for (const auto& [key, child] : node->as_object()) {
-        (void)key;
-        out.push_back(child.get());
+    if (const auto* children = children_of(node)) {
+      for (size_t i = 0; i < children->size(); ++i) {
+        if (!emit((*children)[i].get(), i)) {
+          return false;
+        }
       }
     }
-    return out;
+    return true;
   }
-  if (std::holds_alternative<Selector::Index>(selector.node)) {
+  if (const auto* index = std::get_if<Selector::Index>(&selector.node)) {
     if (!node->is_array()) {
-      return out;
+      return true;
     }
     const auto& arr = node->as_array();
-    int64_t idx = std::get<Selector::Index>(selector.node).value;
+    int64_t idx = index->value;
     int64_t size = static_cast<int64_t>(arr.size());
     if (idx < 0) {
       idx = size + idx;
     }
-    if (idx >= 0 && idx < size) {
-      out.push_back(arr[static_cast<size_t>(idx)].get());
-    }
-    return out;
+    return idx < 0 || idx >= size || emit(arr[static_cast<size_t>(idx)].get(), static_cast<size_t>(idx));
   }
-  if (std::holds_alternative<Selector::SliceSel>(selector.node)) {
+  if (const auto* slice = std::get_if<Selector::SliceSel>(&selector.node)) {
     if (!node->is_array()) {
-      return out;
+      return true;
     }
     const auto& arr = node->as_array();
-    int64_t size = static_cast<int64_t>(arr.size());
-    const Slice& slice = std::get<Selector::SliceSel>(selector.node).value;
-    int64_t step = slice.step.value_or(1);
-    if (step == 0) {
-      return out;
-    }
-    auto normalize = [&](int64_t idx) {
-      return idx >= 0 ? idx : size + idx;
-    };
-    int64_t start = slice.start.has_value() ? normalize(*slice.start) : (step > 0 ? 0 : size - 1);
-    int64_t end = slice.end.has_value() ? normalize(*slice.end) : (step > 0 ? size : -1);
-
-    if (step > 0) {
-      start = clamp_int64(start, 0, size);
-      end = clamp_int64(end, 0, size);
-      for (int64_t i = start; i < end; i += step) {
-        out.push_back(arr[static_cast<size_t>(i)].get());
-      }
-    } else {
-      start = clamp_int64(start, -1, size - 1);
-      end = clamp_int64(end, -1, size - 1);
-      for (int64_t i = start; i > end; i += step) {
-        out.push_back(arr[static_cast<size_t>(i)].get());
+    return for_each_slice_index(slice->value, static_cast<int64_t>(arr.size()),
+                                [&](size_t i) { return emit(arr[i].get(), i); });
+  }
+  const auto& filter = std::get<Selector::Filter>(selector.node);
+  const auto* children = children_of(node);
+  if (children && !children->empty()) {
+    const HoistedValue* hoisted = filter.program.hoisted.empty() ? nullptr : hoisted_values(filter.program, ctx);
+    for (size_t i = 0; i < children->size(); ++i) {
+      const Json* child = (*children)[i].get();
+      EvalContext child_ctx{ctx.root, child, ctx.buffers, hoisted};
+      if (run_filter(filter.program, child_ctx) && !emit(child, i)) {
+        return false;
       }
     }
-    return out;
   }
-  if (std::holds_alternative<Selector::Filter>(selector.node)) {
-    const auto& filter = std::get<Selector::Filter>(selector.node);
-    if (node->is_array()) {
-      for (const auto& child : node->as_array()) {
-        EvalContext child_ctx{ctx.root, child.get()};
-        if (eval_expr(*filter.expr, child_ctx)) {
-          out.push_back(child.get());
-        }
-      }
-    } else if (node->is_object()) {
-      for (const auto& [key, child] : node->as_object()) {
-        (void)key;
-        EvalContext child_ctx{ctx.root, child.get()};
-        if (eval_expr(*filter.expr, child_ctx)) {
-          out.push_back(child.get());
+  return true;
+}
+
+}  // namespace
+
+void detail::apply_segment(const Segment& segment, const NodeList& input, const EvalContext& ctx, NodeList& out) {
+  auto append = [&](const Json* node, size_t) {
+    out.push_back(node);
+    return true;
+  };
+  for (const auto* node : input) {
+    if (segment.descendant) {
+      for_each_descendant(node, ctx.buffers->frames, [&](const Json* candidate) {
+        for (const auto& selector : segment.selectors) {
+          for_each_selected(selector, candidate, ctx, append);
         }
+        return true;
+      });
+    } else {
+      for (const auto& selector : segment.selectors) {
+        for_each_selected(selector, node, ctx, append);
       }
     }
-    return out;
   }
-  return out;
 }
 
-NodeList apply_segment(const Segment& segment, const NodeList& input, const EvalContext& ctx) {
-  NodeList out;
-  if (segment.descendant) {
-    for (const auto* node : input) {
-      NodeList descendants;
-      collect_descendants(node, descendants);
-      for (const auto* candidate : descendants) {
-        for (const auto& selector : segment.selectors) {
-          NodeList matched = apply_selector(selector, candidate, ctx);
-          out.insert(out.end(), matched.begin(), matched.end());
-        }
+namespace {
+
+// Passes each node reached from node through query.segments[seg..] to emit
+// as soon as it is found, until emit returns false. Returns false if it
+// stopped early.
+template <typename Emit>
+bool for_each_match(const Query& query, size_t seg, const Json* node, const EvalContext& ctx, Emit& emit) {
+  if (seg == query.segments.size()) {
+    return emit(node);
+  }
+  const Segment& segment = query.segments[seg];
+  auto next = [&](const Json* child, size_t) { return for_each_match(query, seg + 1, child, ctx, emit); };
+  auto selectors = [&](const Json* candidate) {
+    for (const auto& selector : segment.selectors) {
+      if (!for_each_selected(selector, candidate, ctx, next)) {
+        return false;
       }
     }
-    return out;
+    return true;
+  };
+  if (segment.descendant) {
+    return for_each_descendant(node, ctx.buffers->frames, selectors);
   }
-  for (const auto* node : input) {
+  return selectors(node);
+}
+
+// for_each_descendant that also passes visit a function returning the step
+// of the node being visited. Steps for the nodes on the way down are made
+// only when a visit asks for one.
+template <typename Visit>
+bool for_each_located_descendant(const Json* node, const detail::PathStep* step, detail::PathArena& arena,
+                                 Visit&& visit) {
+  auto& stack = arena.frames;
+  size_t base = stack.size();
+  auto locate = [&]() {
+    size_t k = stack.size();
+    while (k > base && !stack[k - 1].step) {
+      --k;
+    }
+    const detail::PathStep* parent = k == base ? step : stack[k - 1].step;
+    for (; k < stack.size(); ++k) {
+      auto& frame = stack[k];
+      parent = arena.add(parent, frame.container, static_cast<size_t>(frame.next - frame.begin - 1));
+      frame.step = parent;
+    }
+    return parent;
+  };
+  while (true) {
+    if (!visit(node, locate)) {
+      stack.resize(base);
+      return false;
+    }
+    const auto* children = children_of(node);
+    if (children && !children->empty()) {
+      const auto* data = children->data();
+      stack.push_back({data, data, data + children->size(), node, nullptr});
+    }
+    while (stack.size() > base && stack.back().next == stack.back().end) {
+      stack.pop_back();
+    }
+    if (stack.size() == base) {
+      return true;
+    }
+    auto& top = stack.back();
+    node = (top.next++)->get();
+    top.step = nullptr;
+  }
+}
+
+// for_each_match that also tracks where each node it passes on is; emit
+// receives the node and its step (nullptr for the root).
+template <typename Emit>
+bool for_each_located_match(const Query& query, size_t seg, const Json* node, const detail::PathStep* step,
+                            const EvalContext& ctx, detail::PathArena& arena, Emit& emit) {
+  if (seg == query.segments.size()) {
+    return emit(node, step);
+  }
+  const Segment& segment = query.segments[seg];
+  auto selectors = [&](const Json* candidate, auto&& locate) {
     for (const auto& selector : segment.selectors) {
-      NodeList matched = apply_selector(selector, node, ctx);
-      out.insert(out.end(), matched.begin(), matched.end());
+      bool more = for_each_selected(selector, candidate, ctx, [&](const Json* child, size_t position) {
+        const detail::PathStep* child_step = arena.add(locate(), candidate, position);
+        return for_each_located_match(query, seg + 1, child, child_step, ctx, arena, emit);
+      });
+      if (!more) {
+        return false;
+      }
     }
+    return true;
+  };
+  if (segment.descendant) {
+    return for_each_located_descendant(node, step, arena, selectors);
   }
-  return out;
+  return selectors(node, [step] { return step; });
 }
 
-NodeList eval_query(const Query& query, const Json* root, const Json* start) {
-  NodeList nodes;
-  nodes.push_back(start);
-  EvalContext ctx{root, start};
-  for (const auto& segment : query.segments) {
-    nodes = apply_segment(segment, nodes, ctx);
+// Runs a whole query from root through for_each_match.
+template <typename Emit>
+bool evaluate(const Query& query, const Json& root, Emit& emit) {
+  detail::EvalBuffers buffers;
+  buffers.reset_hoisted(query.hoisted_runs, query.hoisted_values);
+  EvalContext ctx{&root, &root, &buffers};
+  return for_each_match(query, 0, &root, ctx, emit);
+}
+
+}  // namespace
+
+// Applies query.segments[first..] starting from start and leaves the result
+// in out, swapping between out and one borrowed list as segments go by.
+void detail::eval_segments(const Query& query, size_t first, const Json* start, const EvalContext& ctx, NodeList& out) {
+  out.clear();
+  out.push_back(start);
+  if (first == query.segments.size()) {
+    return;
+  }
+  ScopedNodeList next(*ctx.buffers);
+  for (size_t i = first; i < query.segments.size(); ++i) {
+    next->clear();
+    apply_segment(query.segments[i], out, ctx, *next);
+    out.swap(*next);
+  }
+}
+
+namespace {
+
+const Json* query_start(const Query& query, const EvalContext& ctx) {
+  return query.absolute ? ctx.root : ctx.current;
+}
+
+const Json* member_of(const Json* node, std::string_view name, size_t hash) {
+  if (!node->is_object()) {
+    return nullptr;
   }
-  return nodes;
+  const auto& obj = node->as_object();
+  auto it = obj.find(name, hash);
+  return it == obj.end() ? nullptr : it->second.get();
 }
 
-ValueResult eval_query_value(const Query& query, const Json* root, const Json* start) {
-  NodeList nodes = eval_query(query, root, start);
-  if (nodes.empty()) {
+const Json* element_of(const Json* node, int64_t index) {
+  if (!node->is_array()) {
+    return nullptr;
+  }
+  const auto& arr = node->as_array();
+  int64_t size = static_cast<int64_t>(arr.size());
+  if (index < 0) {
+    index += size;
+  }
+  return index < 0 || index >= size ? nullptr : arr[static_cast<size_t>(index)].get();
+}
+
+// Follows a singular query's names and indices down from start, without
+// going through node lists. Returns nullptr if a step is missing.
+const Json* get_singular(const Query& query, const Json* node) {
+  for (const Segment& segment : query.segments) {
+    const Selector& selector = segment.selectors.front();
+    if (const auto* name = std::get_if<Selector::Name>(&selector.node)) {
+      node = member_of(node, name->value, name->hash);
+    } else {
+      node = element_of(node, std::get<Selector::Index>(selector.node).value);
+    }
+    if (!node) {
+      return nullptr;
+    }
+  }
+  return node;
+}
+
+// Evaluates a query nested in a filter into out.
+void eval_query(const Query& query, const EvalContext& ctx, NodeList& out) {
+  eval_segments(query, 0, query_start(query, ctx), ctx, out);
+}
+
+ValueResult eval_query_value(const Query& query, const EvalContext& ctx) {
+  if (query.singular) {
+    const Json* node = get_singular(query, query_start(query, ctx));
+    return node ? make_ref(node) : make_nothing();
+  }
+  ScopedNodeList nodes(*ctx.buffers);
+  eval_query(query, ctx, *nodes);
+  if (nodes->empty()) {
     return make_nothing();
   }
-  if (nodes.size() != 1) {
+  if (nodes->size() != 1) {
     throw std::runtime_error("Singular query returned multiple nodes");
   }
-  return make_ref(nodes.front());
+  return make_ref(nodes->front());
 }
 
 struct FunctionResult {
@@ -1042,151 +1569,156 @@ struct FunctionResult {
   bool logical = false;
 };
 
-FunctionResult eval_function(const FunctionExpr& func, const EvalContext& ctx) {
-  if (func.name == "length") {
-    const auto& arg = func.args[0];
-    ValueResult value;
-    if (std::holds_alternative<Literal>(arg)) {
-      value = make_literal(std::get<Literal>(arg).value);
-    } else if (std::holds_alternative<Query>(arg)) {
-      value = eval_query_value(std::get<Query>(arg), ctx.root, ctx.current);
-    } else if (std::holds_alternative<std::unique_ptr<FunctionExpr>>(arg)) {
-      auto& fn = *std::get<std::unique_ptr<FunctionExpr>>(arg);
-      FunctionResult res = eval_function(fn, ctx);
-      if (res.type != FnReturn::Value) {
-        throw std::runtime_error("length() expects ValueType argument");
-      }
-      value = res.value;
-    } else {
-      throw std::runtime_error("Invalid length() argument");
-    }
-    if (value.is_nothing) {
-      return FunctionResult{FnReturn::Value, make_nothing(), false};
-    }
-    const Json& v = value.value();
-    if (v.is_string()) {
-      return FunctionResult{FnReturn::Value, make_literal(Json(static_cast<double>(v.as_string().size()))), false};
-    }
-    if (v.is_array()) {
-      return FunctionResult{FnReturn::Value, make_literal(Json(static_cast<double>(v.as_array().size()))), false};
-    }
-    if (v.is_object()) {
-      return FunctionResult{FnReturn::Value, make_literal(Json(static_cast<double>(v.as_object().size()))), false};
-    }
-    return FunctionResult{FnReturn::Value, make_nothing(), false};
+FunctionResult value_result(ValueResult value) {
+  return FunctionResult{FnReturn::Value, std::move(value), false};
+}
+
+FunctionResult logical_result(bool logical) {
+  return FunctionResult{FnReturn::Logical, make_nothing(), logical};
+}
+
+// Argument for a Value parameter: a literal, a singular query or a
+// value-returning function.
+ValueResult eval_value_arg(const FunctionArgExpr& arg, const EvalContext& ctx) {
+  if (const auto* literal = std::get_if<Literal>(&arg)) {
+    return make_ref(&literal->value);
   }
+  if (const auto* query = std::get_if<Query>(&arg)) {
+    return eval_query_value(*query, ctx);
+  }
+  const FunctionExpr& fn = *std::get<std::unique_ptr<FunctionExpr>>(arg);
+  return fn.impl(fn, ctx).value;
+}
 
-  if (func.name == "count") {
-    const auto& arg = func.args[0];
-    if (!std::holds_alternative<Query>(arg)) {
-      throw std::runtime_error("count() expects NodesType argument");
-    }
-    NodeList nodes = eval_query(std::get<Query>(arg), ctx.root, ctx.current);
-    return FunctionResult{FnReturn::Value, make_literal(Json(static_cast<double>(nodes.size()))), false};
+void eval_nodes_arg(const FunctionArgExpr& arg, const EvalContext& ctx, NodeList& out) {
+  eval_query(std::get<Query>(arg), ctx, out);
+}
+
+FunctionResult call_length(const FunctionExpr& func, const EvalContext& ctx) {
+  ValueResult value = eval_value_arg(func.args[0], ctx);
+  if (value.is_nothing) {
+    return value_result(make_nothing());
+  }
+  const Json& v = value.value();
+  if (v.is_string()) {
+    return value_result(make_literal(Json(static_cast<int64_t>(v.as_string().size()))));
   }
+  if (v.is_array()) {
+    return value_result(make_literal(Json(static_cast<int64_t>(v.as_array().size()))));
+  }
+  if (v.is_object()) {
+    return value_result(make_literal(Json(static_cast<int64_t>(v.as_object().size()))));
+  }
+  return value_result(make_nothing());
+}
 
-  if (func.name == "value") {
-    const auto& arg = func.args[0];
-    if (!std::holds_alternative<Query>(arg)) {
-      throw std::runtime_error("value() expects NodesType argument");
-    }
-    NodeList nodes = eval_query(std::get<Query>(arg), ctx.root, ctx.current);
-    if (nodes.size() != 1) {
-      return FunctionResult{FnReturn::Value, make_nothing(), false};
-    }
-    return FunctionResult{FnReturn::Value, make_ref(nodes.front()), false};
+FunctionResult call_count(const FunctionExpr& func, const EvalContext& ctx) {
+  ScopedNodeList nodes(*ctx.buffers);
+  eval_nodes_arg(func.args[0], ctx, *nodes);
+  return value_result(make_literal(Json(static_cast<int64_t>(nodes->size()))));
+}
+
+FunctionResult call_value(const FunctionExpr& func, const EvalContext& ctx) {
+  ScopedNodeList nodes(*ctx.buffers);
+  eval_nodes_arg(func.args[0], ctx, *nodes);
+  if (nodes->size() != 1) {
+    return value_result(make_nothing());
   }
+  return value_result(make_ref(nodes->front()));
+}
 
-  if (func.name == "match" || func.name == "search") {
-    auto eval_value_arg = [&](const std::variant<Literal, Query, std::unique_ptr<FunctionExpr>, std::unique_ptr<Expr>>& arg) {
-      if (std::holds_alternative<Literal>(arg)) {
-        return make_literal(std::get<Literal>(arg).value);
-      }
-      if (std::holds_alternative<Query>(arg)) {
-        return eval_query_value(std::get<Query>(arg), ctx.root, ctx.current);
-      }
-      if (std::holds_alternative<std::unique_ptr<FunctionExpr>>(arg)) {
-        auto& fn = *std::get<std::unique_ptr<FunctionExpr>>(arg);
-        FunctionResult res = eval_function(fn, ctx);
-        if (res.type != FnReturn::Value) {
-          throw std::runtime_error("Function argument expected ValueType");
-        }
-        return res.value;
-      }
-      throw std::runtime_error("Invalid argument");
-    };
+FunctionResult call_regex(const FunctionExpr& func, const EvalContext& ctx, bool search) {
+  ValueResult subject = eval_value_arg(func.args[0], ctx);
+  if (subject.is_nothing || !subject.value().is_string()) {
+    return logical_result(false);
+  }
+  const CompiledRegex* regex = func.regex.get();
+  if (!regex) {
+    ValueResult pattern = eval_value_arg(func.args[1], ctx);
+    if (pattern.is_nothing || !pattern.value().is_string()) {
+      return logical_result(false);
+    }
+    thread_local RegexCache cache;
+    regex = &cache.get(pattern.value().as_string(), search);
+  }
+  return logical_result(regex->matches(subject.value().as_string()));
+}
 
-    ValueResult arg1 = eval_value_arg(func.args[0]);
-    ValueResult arg2 = eval_value_arg(func.args[1]);
-    if (arg1.is_nothing || arg2.is_nothing) {
-      return FunctionResult{FnReturn::Logical, make_nothing(), false};
-    }
-    const Json& v1 = arg1.value();
-    const Json& v2 = arg2.value();
-    if (!v1.is_string() || !v2.is_string()) {
-      return FunctionResult{FnReturn::Logical, make_nothing(), false};
-    }
-    try {
-      std::regex regex(v2.as_string(), std::regex::ECMAScript);
-      bool matched = false;
-      if (func.name == "match") {
-        matched = std::regex_match(v1.as_string(), regex);
-      } else {
-        matched = std::regex_search(v1.as_string(), regex);
-      }
-      return FunctionResult{FnReturn::Logical, make_nothing(), matched};
-    } catch (const std::regex_error&) {
-      return FunctionResult{FnReturn::Logical, make_nothing(), false};
+FunctionResult call_match(const FunctionExpr& func, const EvalContext& ctx) {
+  return call_regex(func, ctx, false);
+}
+
+FunctionResult call_search(const FunctionExpr& func, const EvalContext& ctx) {
+  return call_regex(func, ctx, true);
+}
+
+FunctionResult call_custom(const FunctionExpr& func, const EvalContext& ctx) {
+  size_t count = func.args.size();
+  FunctionArg args[kMaxFunctionParams];
+  ValueResult values[kMaxFunctionParams];
+  std::optional<ScopedNodeList> nodes[kMaxFunctionParams];
+  for (size_t i = 0; i < count; ++i) {
+    switch (func.params[i]) {
+      case ParamType::Value:
+        values[i] = eval_value_arg(func.args[i], ctx);
+        args[i].value = values[i].is_nothing ? nullptr : &values[i].value();
+        break;
+      case ParamType::Nodes:
+        nodes[i].emplace(*ctx.buffers);
+        eval_nodes_arg(func.args[i], ctx, **nodes[i]);
+        args[i].nodes = &**nodes[i];
+        break;
+      case ParamType::Logical:
+        args[i].logical = eval_expr(*std::get<std::unique_ptr<Expr>>(func.args[i]), ctx);
+        break;
     }
   }
-
-  throw std::runtime_error("Unknown function");
+  FunctionValue result = func.custom->impl(args, count);
+  if (func.ret == FnReturn::Logical) {
+    return logical_result(result.logical);
+  }
+  if (result.ref) {
+    return value_result(make_ref(result.ref));
+  }
+  if (result.value) {
+    return value_result(make_literal(std::move(*result.value)));
+  }
+  return value_result(make_nothing());
 }
 
 bool eval_test_item(const TestItem& item, const EvalContext& ctx) {
-  if (std::holds_alternative<Query>(item.node)) {
-    const Query& query = std::get<Query>(item.node);
-    const Json* start = query.absolute ? ctx.root : ctx.current;
-    NodeList nodes = eval_query(query, ctx.root, start);
-    return !nodes.empty();
-  }
-  const auto& func = *std::get<std::unique_ptr<FunctionExpr>>(item.node);
-  FunctionResult result = eval_function(func, ctx);
-  if (result.type == FnReturn::Logical) {
-    return result.logical;
+  if (const auto* query = std::get_if<Query>(&item.node)) {
+    auto stop = [](const Json*) { return false; };
+    return !for_each_match(*query, 0, query_start(*query, ctx), ctx, stop);
   }
-  throw std::runtime_error("Value-returning function cannot be used as test expression");
+  const FunctionExpr& func = *std::get<std::unique_ptr<FunctionExpr>>(item.node);
+  return func.impl(func, ctx).logical;
 }
 
 ValueResult eval_comparable(const Comparable& comp, const EvalContext& ctx) {
-  if (std::holds_alternative<Literal>(comp.node)) {
-    return make_literal(std::get<Literal>(comp.node).value);
+  if (const auto* literal = std::get_if<Literal>(&comp.node)) {
+    return make_ref(&literal->value);
   }
-  if (std::holds_alternative<Query>(comp.node)) {
-    const Query& query = std::get<Query>(comp.node);
-    const Json* start = query.absolute ? ctx.root : ctx.current;
-    return eval_query_value(query, ctx.root, start);
+  if (const auto* query = std::get_if<Query>(&comp.node)) {
+    return eval_query_value(*query, ctx);
   }
-  const auto& func = *std::get<std::unique_ptr<FunctionExpr>>(comp.node);
-  FunctionResult result = eval_function(func, ctx);
-  if (result.type != FnReturn::Value) {
-    throw std::runtime_error("Comparable requires value-returning function");
-  }
-  return result.value;
+  const FunctionExpr& func = *std::get<std::unique_ptr<FunctionExpr>>(comp.node);
+  return func.impl(func, ctx).value;
 }
 
-bool compare_values(const ValueResult& lhs, const ValueResult& rhs, CompareOp op) {
-  if (lhs.is_nothing || rhs.is_nothing) {
+// Compares two operands, nullptr standing for Nothing.
+bool compare_nodes(const Json* lhs, const Json* rhs, CompareOp op) {
+  if (!lhs || !rhs) {
     if (op == CompareOp::Eq) {
-      return lhs.is_nothing && rhs.is_nothing;
+      return !lhs && !rhs;
     }
     if (op == CompareOp::Ne) {
-      return lhs.is_nothing != rhs.is_nothing;
+      return !lhs != !rhs;
     }
     return false;
   }
-  const Json& left = lhs.value();
-  const Json& right = rhs.value();
+  const Json& left = *lhs;
+  const Json& right = *rhs;
 
   if (op == CompareOp::Eq || op == CompareOp::Ne) {
     bool eq = compare_json_values(left, right);
@@ -1194,17 +1726,18 @@ bool compare_values(const ValueResult& lhs, const ValueResult& rhs, CompareOp op
   }
 
   if (left.is_number() && right.is_number()) {
+    int order = compare_numbers(left, right);
     if (op == CompareOp::Lt) {
-      return left.as_number() < right.as_number();
+      return order < 0;
     }
     if (op == CompareOp::Lte) {
-      return left.as_number() <= right.as_number();
+      return order <= 0;
     }
     if (op == CompareOp::Gt) {
-      return left.as_number() > right.as_number();
+      return order > 0;
     }
     if (op == CompareOp::Gte) {
-      return left.as_number() >= right.as_number();
+      return order >= 0;
     }
   }
 
@@ -1226,6 +1759,10 @@ bool compare_values(const ValueResult& lhs, const ValueResult& rhs, CompareOp op
   return false;
 }
 
+bool compare_values(const ValueResult& lhs, const ValueResult& rhs, CompareOp op) {
+  return compare_nodes(lhs.is_nothing ? nullptr : &lhs.value(), rhs.is_nothing ? nullptr : &rhs.value(), op);
+}
+
 bool eval_expr(const Expr& expr, const EvalContext& ctx) {
   if (std::holds_alternative<Expr::Or>(expr.node)) {
     const auto& node = std::get<Expr::Or>(expr.node);
@@ -1249,20 +1786,546 @@ bool eval_expr(const Expr& expr, const EvalContext& ctx) {
   return eval_test_item(node.item, ctx);
 }
 
+// Resolves a singular query from a FilterProgram, or returns nullptr if it
+// selects nothing.
+const Json* resolve_path(const FilterProgram& program, uint32_t index, const EvalContext& ctx) {
+  const FilterProgram::Path& path = program.paths[index];
+  const Json* node = path.absolute ? ctx.root : ctx.current;
+  const FilterProgram::Step* step = program.steps.data() + path.first;
+  for (const FilterProgram::Step* end = step + path.count; step != end && node; ++step) {
+    node = step->is_name ? member_of(node, step->name, step->hash) : element_of(node, step->index);
+  }
+  return node;
+}
+
+// The value of an operand, or nullptr for Nothing. Results that are not
+// nodes of the document are kept in storage.
+const Json* filter_value(const FilterProgram& program, FilterProgram::Operand operand, const EvalContext& ctx,
+                         ValueResult& storage) {
+  switch (operand.source) {
+    case FilterProgram::Source::Literal:
+      return program.literals[operand.index];
+    case FilterProgram::Source::Path:
+      return resolve_path(program, operand.index, ctx);
+    case FilterProgram::Source::Query:
+      storage = eval_query_value(*program.queries[operand.index], ctx);
+      break;
+    case FilterProgram::Source::Function: {
+      const FunctionExpr& func = *program.functions[operand.index];
+      storage = func.impl(func, ctx).value;
+      break;
+    }
+    case FilterProgram::Source::Hoisted:
+      return ctx.hoisted[operand.index].value;
+  }
+  return storage.is_nothing ? nullptr : &storage.value();
+}
+
+bool filter_test(const FilterProgram& program, FilterProgram::Operand operand, const EvalContext& ctx) {
+  switch (operand.source) {
+    case FilterProgram::Source::Path:
+      return resolve_path(program, operand.index, ctx) != nullptr;
+    case FilterProgram::Source::Hoisted:
+      return ctx.hoisted[operand.index].logical;
+    case FilterProgram::Source::Query: {
+      const Query& query = *program.queries[operand.index];
+      auto stop = [](const Json*) { return false; };
+      return !for_each_match(query, 0, query_start(query, ctx), ctx, stop);
+    }
+    default: {
+      const FunctionExpr& func = *program.functions[operand.index];
+      return func.impl(func, ctx).logical;
+    }
+  }
+}
+
+// The values of program's hoisted operands in this evaluation, worked out the
+// first time it runs. Nested filters met on the way add their own runs
+// after this one.
+const HoistedValue* hoisted_values(const FilterProgram& program, const EvalContext& ctx) {
+  detail::EvalBuffers& buffers = *ctx.buffers;
+  for (const auto& [key, offset] : buffers.hoisted_runs) {
+    if (key == &program) {
+      return buffers.hoisted.data() + offset;
+    }
+  }
+  size_t offset = buffers.hoisted.size();
+  if (offset + program.hoisted.size() > buffers.hoisted.capacity()) {
+    throw std::logic_error("Hoisted filter values were not reserved");
+  }
+  buffers.hoisted_runs.emplace_back(&program, offset);
+  buffers.hoisted.resize(offset + program.hoisted.size());
+  for (size_t i = 0; i < program.hoisted.size(); ++i) {
+    const auto& [operand, test] = program.hoisted[i];
+    HoistedValue& slot = buffers.hoisted[offset + i];
+    if (test) {
+      slot.logical = filter_test(program, operand, ctx);
+    } else {
+      slot.value = filter_value(program, operand, ctx, slot.storage);
+    }
+  }
+  return buffers.hoisted.data() + offset;
+}
+
+}  // namespace
+
+bool detail::run_filter(const FilterProgram& program, const EvalContext& ctx) {
+  bool flag = false;
+  const FilterProgram::Instruction* code = program.code.data();
+  const size_t size = program.code.size();
+  for (size_t pc = 0; pc < size; ++pc) {
+    const FilterProgram::Instruction& instruction = code[pc];
+    switch (instruction.op) {
+      case FilterProgram::Op::Compare: {
+        ValueResult left_storage;
+        ValueResult right_storage;
+        const Json* left = filter_value(program, instruction.left, ctx, left_storage);
+        const Json* right = filter_value(program, instruction.right, ctx, right_storage);
+        flag = compare_nodes(left, right, instruction.cmp);
+        break;
+      }
+      case FilterProgram::Op::Test:
+        flag = filter_test(program, instruction.left, ctx);
+        break;
+      case FilterProgram::Op::Not:
+        flag = !flag;
+        break;
+      case FilterProgram::Op::Constant:
+        flag = instruction.left.index != 0;
+        break;
+      case FilterProgram::Op::JumpIfFalse:
+        if (!flag) {
+          pc = instruction.right.index - 1;
+        }
+        break;
+      case FilterProgram::Op::JumpIfTrue:
+        if (flag) {
+          pc = instruction.right.index - 1;
+        }
+        break;
+    }
+  }
+  return flag;
+}
+
+namespace {
+
+bool query_uses_root(const Query& query);
+
+bool function_uses_root(const FunctionExpr& func) {
+  for (const auto& arg : func.args) {
+    if (const auto* query = std::get_if<Query>(&arg)) {
+      if (query_uses_root(*query)) {
+        return true;
+      }
+    } else if (const auto* fn = std::get_if<std::unique_ptr<FunctionExpr>>(&arg)) {
+      if (function_uses_root(**fn)) {
+        return true;
+      }
+    } else if (const auto* logical = std::get_if<std::unique_ptr<Expr>>(&arg)) {
+      if (expr_uses_root(**logical)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool comparable_uses_root(const Comparable& comp) {
+  if (const auto* query = std::get_if<Query>(&comp.node)) {
+    return query_uses_root(*query);
+  }
+  if (const auto* fn = std::get_if<std::unique_ptr<FunctionExpr>>(&comp.node)) {
+    return function_uses_root(**fn);
+  }
+  return false;
+}
+
 }  // namespace
 
-struct JsonPath::Impl {
-  Query query;
+bool detail::expr_uses_root(const Expr& expr) {
+  if (const auto* node = std::get_if<Expr::Or>(&expr.node)) {
+    return expr_uses_root(*node->left) || expr_uses_root(*node->right);
+  }
+  if (const auto* node = std::get_if<Expr::And>(&expr.node)) {
+    return expr_uses_root(*node->left) || expr_uses_root(*node->right);
+  }
+  if (const auto* node = std::get_if<Expr::Not>(&expr.node)) {
+    return expr_uses_root(*node->expr);
+  }
+  if (const auto* node = std::get_if<Expr::Comparison>(&expr.node)) {
+    return comparable_uses_root(node->left) || comparable_uses_root(node->right);
+  }
+  const auto& item = std::get<Expr::Test>(expr.node).item;
+  if (const auto* query = std::get_if<Query>(&item.node)) {
+    return query_uses_root(*query);
+  }
+  return function_uses_root(*std::get<std::unique_ptr<FunctionExpr>>(item.node));
+}
+
+namespace {
+
+// True if evaluating any filter in query needs the document root.
+bool query_uses_root(const Query& query) {
+  if (query.absolute) {
+    return true;
+  }
+  for (const auto& segment : query.segments) {
+    for (const auto& selector : segment.selectors) {
+      const auto* filter = std::get_if<Selector::Filter>(&selector.node);
+      if (filter && expr_uses_root(*filter->expr)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// select_raw can work on the unparsed text unless the query needs the whole
+// tree: descendant segments visit every node, and filters that refer to $ need
+// the root materialized.
+bool supports_raw(const Query& query) {
+  for (const auto& segment : query.segments) {
+    if (segment.descendant) {
+      return false;
+    }
+    for (const auto& selector : segment.selectors) {
+      const auto* filter = std::get_if<Selector::Filter>(&selector.node);
+      if (filter && expr_uses_root(*filter->expr)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+Json materialize(std::string_view input, RawSpan span) {
+  return parse_json(input.substr(span.begin, span.end - span.begin));
+}
+
+bool raw_key_equals(std::string_view input, std::string_view key, bool escaped, std::string_view name) {
+  if (!escaped) {
+    return key == name;
+  }
+  // Rare: decode the quoted key through the full parser.
+  size_t open = static_cast<size_t>(key.data() - input.data()) - 1;
+  return materialize(input, RawSpan{open, open + key.size() + 2}).as_string() == name;
+}
+
+struct RawEval {
+  const Query& query;
+  std::string_view input;
+  RawScanner& scanner;
+  detail::EvalBuffers& buffers;
+  RawNodes& out;
 };
 
+void eval_raw_at(const RawEval& eval, size_t seg);
+
+// Goes on from the child at span with the next segment, leaving the cursor
+// after it.
+void descend_raw(const RawEval& eval, size_t seg, RawSpan span) {
+  if (seg + 1 == eval.query.segments.size()) {
+    eval.out.push_back(span);
+    return;
+  }
+  eval.scanner.seek(span.begin);
+  eval_raw_at(eval, seg + 1);
+  eval.scanner.seek(span.end);
+}
+
+// Applies selector to the value at the cursor. A name or a non-negative index
+// picks at most one child, which is gone on with where the cursor finds it,
+// without first stepping over it; the cursor is then left inside the value.
+void apply_raw_selector(const RawEval& eval, size_t seg, const Selector& selector) {
+  RawScanner& scanner = eval.scanner;
+  char kind = scanner.kind();
+  if (const auto* name = std::get_if<Selector::Name>(&selector.node)) {
+    // The first occurrence of a duplicated name wins, so the scan can stop.
+    bool found = false;
+    if (kind == '{') {
+      scanner.members([&](std::string_view key, bool escaped) {
+        found = raw_key_equals(eval.input, key, escaped, name->value);
+        if (!found) {
+          scanner.value();
+        }
+        return !found;
+      });
+    }
+    if (found) {
+      eval_raw_at(eval, seg + 1);
+    }
+    return;
+  }
+  if (std::holds_alternative<Selector::Wildcard>(selector.node)) {
+    if (kind == '[') {
+      scanner.elements([&] {
+        descend_raw(eval, seg, scanner.value());
+        return true;
+      });
+    } else if (kind == '{') {
+      scanner.members([&](std::string_view, bool) {
+        descend_raw(eval, seg, scanner.value());
+        return true;
+      });
+    }
+    return;
+  }
+  if (kind != '[' && !std::holds_alternative<Selector::Filter>(selector.node)) {
+    return;
+  }
+  if (const auto* index = std::get_if<Selector::Index>(&selector.node)) {
+    if (index->value >= 0) {
+      int64_t remaining = index->value;
+      bool found = false;
+      scanner.elements([&] {
+        found = remaining-- == 0;
+        if (!found) {
+          scanner.value();
+        }
+        return !found;
+      });
+      if (found) {
+        eval_raw_at(eval, seg + 1);
+      }
+      return;
+    }
+    RawNodes elements;
+    scanner.elements([&] {
+      elements.push_back(scanner.value());
+      return true;
+    });
+    int64_t idx = static_cast<int64_t>(elements.size()) + index->value;
+    if (idx >= 0) {
+      descend_raw(eval, seg, elements[static_cast<size_t>(idx)]);
+    }
+    return;
+  }
+  if (const auto* slice = std::get_if<Selector::SliceSel>(&selector.node)) {
+    RawNodes elements;
+    scanner.elements([&] {
+      elements.push_back(scanner.value());
+      return true;
+    });
+    for_each_slice_index(slice->value, static_cast<int64_t>(elements.size()), [&](size_t i) {
+      descend_raw(eval, seg, elements[i]);
+      return true;
+    });
+    return;
+  }
+  // Filters see one materialized candidate at a time; supports_raw() has
+  // ruled out references to the root.
+  const auto& filter = std::get<Selector::Filter>(selector.node);
+  auto test = [&] {
+    RawSpan value = scanner.value();
+    Json candidate = materialize(eval.input, value);
+    EvalContext ctx{&candidate, &candidate, &eval.buffers};
+    if (run_filter(filter.program, ctx)) {
+      descend_raw(eval, seg, value);
+    }
+    return true;
+  };
+  if (kind == '[') {
+    scanner.elements(test);
+  } else if (kind == '{') {
+    scanner.members([&](std::string_view, bool) { return test(); });
+  }
+}
+
+// Applies segments seg on to the value at the cursor, depth first, which for
+// child segments gives the matches in the same order as one segment at a time.
+void eval_raw_at(const RawEval& eval, size_t seg) {
+  if (seg == eval.query.segments.size()) {
+    eval.out.push_back(eval.scanner.value());
+    return;
+  }
+  const auto& selectors = eval.query.segments[seg].selectors;
+  eval.scanner.kind();
+  size_t begin = eval.scanner.position();
+  for (size_t i = 0; i < selectors.size(); ++i) {
+    if (i > 0) {
+      eval.scanner.seek(begin);
+    }
+    apply_raw_selector(eval, seg, selectors[i]);
+  }
+}
+
+}  // namespace
+
+RawNodes detail::eval_raw(const Query& query, std::string_view input) {
+  if (query.segments.empty()) {
+    return RawNodes{RawSpan{0, input.size()}};
+  }
+  RawScanner scanner(input);
+  detail::EvalBuffers buffers;
+  RawNodes out;
+  eval_raw_at(RawEval{query, input, scanner, buffers, out}, 0);
+  return out;
+}
+
+void detail::for_each_location(const Query& query, const Json& root, const LocationCallback& on_match) {
+  detail::PathArena arena;
+  detail::EvalBuffers buffers;
+  buffers.reset_hoisted(query.hoisted_runs, query.hoisted_values);
+  EvalContext ctx{&root, &root, &buffers};
+  auto emit = [&](const Json*, const detail::PathStep* step) {
+    on_match(step);
+    return true;
+  };
+  for_each_located_match(query, 0, &root, nullptr, ctx, arena, emit);
+}
+
+namespace {
+
+// Whether a node can be reached more than once: a union can select it twice,
+// and a second descendant segment revisits subtrees the first already entered.
+bool may_repeat(const Query& query) {
+  size_t descendants = 0;
+  for (const Segment& segment : query.segments) {
+    if (segment.selectors.size() > 1) {
+      return true;
+    }
+    descendants += segment.descendant ? 1 : 0;
+  }
+  return descendants > 1;
+}
+
+// The memory resource root's storage comes from, so edits to a Document
+// allocate from its arena.
+std::pmr::memory_resource* resource_of(const Json& root) {
+  if (root.is_array()) {
+    return root.as_array().get_allocator().resource();
+  }
+  if (root.is_object()) {
+    return root.as_object().get_allocator().resource();
+  }
+  if (const auto* s = std::get_if<Json::String>(&root.value)) {
+    return s->get_allocator().resource();
+  }
+  return std::pmr::get_default_resource();
+}
+
+// Deep copy of value with every string, container and node allocated from
+// resource. Borrowed strings are copied too, since the copy may outlive the
+// buffer they point into.
+Json clone(const Json& value, std::pmr::memory_resource* resource) {
+  auto node = [&](const Json& child) {
+    return std::allocate_shared<Json>(std::pmr::polymorphic_allocator<Json>(resource), clone(child, resource));
+  };
+  if (value.is_string()) {
+    return Json(Json::String(value.as_string(), resource));
+  }
+  if (value.is_array()) {
+    Json::Array array(resource);
+    array.reserve(value.as_array().size());
+    for (const auto& child : value.as_array()) {
+      array.push_back(node(*child));
+    }
+    return Json(std::move(array));
+  }
+  if (value.is_object()) {
+    const Json::Object& source = value.as_object();
+    Json::Object object{Json::Object::allocator_type(resource)};
+    for (size_t i = 0; i < source.size(); ++i) {
+      object.insert_or_assign(source.keys()[i].view(), node(*source.values()[i]));
+    }
+    return Json(std::move(object));
+  }
+  return value;
+}
+
+// Edits are made only after the whole query has run, and in reverse document
+// order so that editing a node never disturbs a match inside it.
+std::vector<const Json*> edit_targets(const Query& query, Json& root) {
+  detail::EvalBuffers buffers;
+  buffers.reset_hoisted(query.hoisted_runs, query.hoisted_values);
+  EvalContext ctx{&root, &root, &buffers};
+  std::vector<const Json*> targets;
+  eval_segments(query, 0, &root, ctx, targets);
+  if (may_repeat(query)) {
+    std::unordered_set<const Json*> seen;
+    targets.erase(std::remove_if(targets.begin(), targets.end(),
+                                 [&](const Json* node) { return !seen.insert(node).second; }),
+                  targets.end());
+  }
+  std::reverse(targets.begin(), targets.end());
+  return targets;
+}
+
+size_t assign_targets(const Query& query, Json& root, const Json& value, std::pmr::memory_resource* resource) {
+  std::vector<const Json*> targets = edit_targets(query, root);
+  for (const Json* node : targets) {
+    *const_cast<Json*>(node) = clone(value, resource);
+  }
+  return targets.size();
+}
+
+}  // namespace
+
+std::vector<NodePath::Element> NodePath::elements() const {
+  std::vector<Element> out;
+  for (const detail::PathStep* step = step_; step; step = step->parent) {
+    if (step->container->is_object()) {
+      out.push_back(Element{false, step->container->as_object().keys()[step->position].view(), 0});
+    } else {
+      out.push_back(Element{true, {}, step->position});
+    }
+  }
+  std::reverse(out.begin(), out.end());
+  return out;
+}
+
+std::string NodePath::normalized() const {
+  static const char kHex[] = "0123456789abcdef";
+  std::string out = "$";
+  for (const Element& element : elements()) {
+    if (element.is_index) {
+      out += '[';
+      out += std::to_string(element.index);
+      out += ']';
+      continue;
+    }
+    out += "['";
+    for (char c : element.name) {
+      switch (c) {
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        case '\'': out += "\\'"; break;
+        case '\\': out += "\\\\"; break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20) {
+            out += "\\u00";
+            out += kHex[c >> 4];
+            out += kHex[c & 0xF];
+          } else {
+            out += c;
+          }
+      }
+    }
+    out += "']";
+  }
+  return out;
+}
+
+EvalScratch::EvalScratch() : buffers_(std::make_unique<detail::EvalBuffers>()) {}
+EvalScratch::~EvalScratch() = default;
+EvalScratch::EvalScratch(EvalScratch&&) noexcept = default;
+EvalScratch& EvalScratch::operator=(EvalScratch&&) noexcept = default;
+
 JsonPath::JsonPath(std::shared_ptr<const Impl> impl) : impl_(std::move(impl)) {}
 
 JsonPath JsonPath::compile(std::string_view path) {
   JsonPathParser parser(path);
   Query query = parser.parse_query(true);
   parser.ensure_end();
+  query.hoisted_runs = parser.hoisted_runs();
+  query.hoisted_values = parser.hoisted_values();
   auto impl = std::make_shared<Impl>();
   impl->query = std::move(query);
+  impl->raw = supports_raw(impl->query);
   return JsonPath(std::move(impl));
 }
 
@@ -1270,14 +2333,255 @@ std::vector<const Json*> JsonPath::select(const Json& root) const {
   if (!impl_) {
     throw std::runtime_error("JsonPath is not compiled");
   }
-  const Json* start = &root;
-  NodeList nodes = eval_query(impl_->query, &root, start);
-  return nodes;
+  if (impl_->query.singular) {
+    const Json* node = get_singular(impl_->query, &root);
+    return node ? std::vector<const Json*>{node} : std::vector<const Json*>{};
+  }
+  EvalScratch scratch;
+  std::vector<const Json*> out;
+  select(root, out, scratch);
+  return out;
+}
+
+void JsonPath::select(const Json& root, std::vector<const Json*>& out, EvalScratch& scratch) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  detail::EvalBuffers& buffers = *scratch.buffers_;
+  buffers.frames.clear();
+  buffers.reset_hoisted(impl_->query.hoisted_runs, impl_->query.hoisted_values);
+  EvalContext ctx{&root, &root, &buffers};
+  eval_segments(impl_->query, 0, &root, ctx, out);
+}
+
+bool JsonPath::for_each(const Json& root, const NodeCallback& on_match) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  auto emit = [&](const Json* node) { return on_match(*node); };
+  return evaluate(impl_->query, root, emit);
+}
+
+const Json* JsonPath::select_first(const Json& root) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  if (impl_->query.singular) {
+    return get_singular(impl_->query, &root);
+  }
+  const Json* first = nullptr;
+  auto emit = [&](const Json* node) {
+    first = node;
+    return false;
+  };
+  evaluate(impl_->query, root, emit);
+  return first;
+}
+
+bool JsonPath::exists(const Json& root) const {
+  return select_first(root) != nullptr;
+}
+
+const Json* JsonPath::get(const Json& root) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  if (!impl_->query.singular) {
+    throw std::runtime_error("JsonPath::get requires a singular query");
+  }
+  return get_singular(impl_->query, &root);
+}
+
+Json* JsonPath::get_mut(Json& root) const {
+  return const_cast<Json*>(get(root));
+}
+
+size_t JsonPath::count(const Json& root) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  size_t count = 0;
+  auto emit = [&](const Json*) {
+    ++count;
+    return true;
+  };
+  evaluate(impl_->query, root, emit);
+  return count;
+}
+
+PathMatches JsonPath::select_with_paths(const Json& root) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  auto arena = std::make_shared<detail::PathArena>();
+  detail::EvalBuffers buffers;
+  buffers.reset_hoisted(impl_->query.hoisted_runs, impl_->query.hoisted_values);
+  EvalContext ctx{&root, &root, &buffers};
+  PathMatches result;
+  auto emit = [&](const Json* node, const detail::PathStep* step) {
+    result.matches_.push_back(PathMatch{node, NodePath()});
+    result.matches_.back().path.step_ = step;
+    return true;
+  };
+  for_each_located_match(impl_->query, 0, &root, nullptr, ctx, *arena, emit);
+  arena->frames = {};
+  result.steps_ = std::move(arena);
+  return result;
+}
+
+size_t JsonPath::assign(Json& root, const Json& value) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  return assign_targets(impl_->query, root, value, resource_of(root));
+}
+
+size_t JsonPath::assign(Document& document, const Json& value) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  return assign_targets(impl_->query, document.root(), value, document.resource());
+}
+
+size_t JsonPath::remove(Json& root) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  detail::PathArena arena;
+  detail::EvalBuffers buffers;
+  buffers.reset_hoisted(impl_->query.hoisted_runs, impl_->query.hoisted_values);
+  EvalContext ctx{&root, &root, &buffers};
+  std::vector<std::pair<Json*, size_t>> slots;
+  auto emit = [&](const Json*, const detail::PathStep* step) {
+    if (step) {
+      slots.emplace_back(const_cast<Json*>(step->container), step->position);
+    }
+    return true;
+  };
+  for_each_located_match(impl_->query, 0, &root, nullptr, ctx, arena, emit);
+  std::sort(slots.begin(), slots.end());
+  slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+
+  // Removed nodes are kept alive until the end: a later container may be
+  // inside one of them.
+  std::vector<std::shared_ptr<Json>> removed;
+  removed.reserve(slots.size());
+  for (size_t first = 0; first < slots.size();) {
+    Json* container = slots[first].first;
+    size_t last = first;
+    while (last < slots.size() && slots[last].first == container) {
+      ++last;
+    }
+    if (container->is_array()) {
+      // One compacting pass however many elements go.
+      Json::Array& array = container->as_array();
+      size_t kept = 0;
+      for (size_t i = 0, next = first; i < array.size(); ++i) {
+        if (next < last && slots[next].second == i) {
+          removed.push_back(std::move(array[i]));
+          ++next;
+        } else {
+          array[kept++] = std::move(array[i]);
+        }
+      }
+      array.resize(kept);
+    } else {
+      size_t i = 0;
+      size_t next = first;
+      container->as_object().erase_if([&](std::string_view, std::shared_ptr<Json>& value) {
+        bool match = next < last && slots[next].second == i++;
+        if (match) {
+          removed.push_back(std::move(value));
+          ++next;
+        }
+        return match;
+      });
+    }
+    first = last;
+  }
+  return slots.size();
+}
+
+size_t JsonPath::update(Json& root, const std::function<void(Json&)>& fn) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  std::vector<const Json*> targets = edit_targets(impl_->query, root);
+  for (const Json* node : targets) {
+    fn(*const_cast<Json*>(node));
+  }
+  return targets.size();
+}
+
+std::vector<Json> JsonPath::select_raw(std::string_view json) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  std::vector<Json> out;
+  if (!impl_->raw) {
+    Json root = parse_json(json);
+    for (const Json* node : select(root)) {
+      out.push_back(*node);
+    }
+    return out;
+  }
+  RawNodes nodes = eval_raw(impl_->query, json);
+  out.reserve(nodes.size());
+  for (const RawSpan& node : nodes) {
+    out.push_back(materialize(json, node));
+  }
+  return out;
 }
 
 std::vector<const Json*> select(const Json& root, std::string_view path) {
-  JsonPath compiled = JsonPath::compile(path);
-  return compiled.select(root);
+  return JsonPathCache::shared().get(path).select(root);
+}
+
+std::vector<Json> select_raw(std::string_view json, std::string_view path) {
+  return JsonPathCache::shared().get(path).select_raw(json);
+}
+
+std::vector<Json> select_file(const std::string& file_path, const JsonPath& path) {
+  detail::MappedFile file(file_path);
+  return path.select_raw(file.view());
+}
+
+void register_function(const std::string& name, FunctionType result, std::vector<FunctionType> params,
+                       Function impl) {
+  bool valid_name = !name.empty() && name[0] >= 'a' && name[0] <= 'z';
+  for (char c : name) {
+    valid_name = valid_name && ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_');
+  }
+  if (!valid_name) {
+    throw std::invalid_argument("register_function: invalid function name");
+  }
+  if (find_builtin(name) || name == "true" || name == "false" || name == "null") {
+    throw std::invalid_argument("register_function: reserved function name");
+  }
+  if (result == FunctionType::Nodes) {
+    throw std::invalid_argument("register_function: result must be Value or Logical");
+  }
+  if (params.size() > kMaxFunctionParams) {
+    throw std::invalid_argument("register_function: too many parameters");
+  }
+
+  auto custom = std::make_shared<CustomFunction>();
+  custom->signature.ret = result == FunctionType::Value ? FnReturn::Value : FnReturn::Logical;
+  for (FunctionType param : params) {
+    custom->signature.params.push_back(param == FunctionType::Value   ? ParamType::Value
+                                       : param == FunctionType::Nodes ? ParamType::Nodes
+                                                                      : ParamType::Logical);
+  }
+  custom->impl = std::move(impl);
+
+  {
+    FunctionRegistry& registry = function_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.functions[name] = std::move(custom);
+  }
+  // The free select compiles through the shared cache, whose queries would
+  // otherwise go on calling whatever name meant before.
+  JsonPathCache::shared().clear();
 }
 
 }  // namespace jsonpath
@@ -0,0 +1,55 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace jsonpath {
+namespace detail {
+namespace {
+
+std::runtime_error file_error(const char* what, const std::string& path, int error) {
+  return std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(error));
+}
+
+}  // namespace
+
+MappedFile::MappedFile(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw file_error("Cannot open", path, errno);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    int error = errno;
+    ::close(fd);
+    throw file_error("Cannot stat", path, error);
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ > 0) {
+    void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int error = errno;
+      ::close(fd);
+      throw file_error("Cannot map", path, error);
+    }
+    data_ = data;
+    ::madvise(data_, size_, MADV_SEQUENTIAL);
+  }
+  // The mapping stays valid after the descriptor is closed.
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) {
+    ::munmap(data_, size_);
+  }
+}
+
+}  // namespace detail
+}  // namespace jsonpath
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace jsonpath {
+namespace detail {
+
+// Read-only memory mapping of a whole file, advised for sequential access.
+// Empty files are not mapped and yield an empty view.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::string_view view() const { return std::string_view(static_cast<const char*>(data_), size_); }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace detail
+}  // namespace jsonpath
@@ -0,0 +1,131 @@
+#include "jsonpath/ndjson.hpp"
+
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace jsonpath {
+namespace {
+
+// A line belongs to the batch holding its first byte, so batches can be cut
+// at fixed offsets and each worker finds its own line starts.
+struct Batch {
+  std::vector<NdjsonMatch> matches;  // line numbers relative to the batch
+  size_t lines = 0;
+  size_t error_offset = SIZE_MAX;
+  std::string error;
+};
+
+bool is_blank(std::string_view line) {
+  return std::all_of(line.begin(), line.end(), [](char c) { return c == ' ' || (c >= '\t' && c <= '\r'); });
+}
+
+void run_batch(std::string_view input, size_t begin, size_t end, const JsonPath& path, Batch& batch) {
+  const char* data = input.data();
+  size_t pos = begin;
+  if (begin > 0) {
+    // memchr is the vectorized newline scan; it only looks inside the batch.
+    const void* newline = std::memchr(data + begin - 1, '\n', end - begin);
+    if (!newline) {
+      return;
+    }
+    pos = static_cast<size_t>(static_cast<const char*>(newline) - data) + 1;
+  }
+  while (pos < end && pos < input.size()) {
+    const void* newline = std::memchr(data + pos, '\n', input.size() - pos);
+    size_t line_end = newline ? static_cast<size_t>(static_cast<const char*>(newline) - data) : input.size();
+    std::string_view line = input.substr(pos, line_end - pos);
+    size_t number = batch.lines++;
+    if (!is_blank(line)) {
+      try {
+        for (Json& value : path.select_raw(line)) {
+          batch.matches.push_back(NdjsonMatch{number, std::move(value)});
+        }
+      } catch (const std::exception& e) {
+        if (batch.error_offset == SIZE_MAX) {
+          batch.error_offset = pos;
+          batch.error = e.what();
+        }
+      }
+    }
+    pos = line_end + 1;
+  }
+}
+
+}  // namespace
+
+std::vector<NdjsonMatch> select_ndjson(std::string_view input, const JsonPath& path, const NdjsonOptions& options) {
+  size_t batch_bytes = std::max<size_t>(options.batch_bytes, 1);
+  size_t batch_count = (input.size() + batch_bytes - 1) / batch_bytes;
+  size_t threads = options.threads > 0 ? options.threads : std::max(1U, std::thread::hardware_concurrency());
+  threads = std::min(threads, batch_count);
+
+  std::vector<Batch> batches(batch_count);
+  std::vector<std::vector<size_t>> completed(threads);
+  std::atomic<size_t> next{0};
+  auto work = [&](size_t worker) {
+    for (size_t i = next++; i < batch_count; i = next++) {
+      size_t begin = i * batch_bytes;
+      run_batch(input, begin, std::min(begin + batch_bytes, input.size()), path, batches[i]);
+      completed[worker].push_back(i);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t) {
+    pool.emplace_back(work, t);
+  }
+  if (threads > 0) {
+    work(0);
+  }
+  for (auto& thread : pool) {
+    thread.join();
+  }
+
+  std::vector<size_t> first_line(batch_count);
+  size_t lines = 0;
+  size_t matches = 0;
+  for (size_t i = 0; i < batch_count; ++i) {
+    const Batch& batch = batches[i];
+    if (batch.error_offset != SIZE_MAX) {
+      size_t line = static_cast<size_t>(std::count(input.begin(), input.begin() + batch.error_offset, '\n')) + 1;
+      throw std::runtime_error("line " + std::to_string(line) + ": " + batch.error);
+    }
+    first_line[i] = lines + 1;
+    lines += batch.lines;
+    matches += batch.matches.size();
+  }
+
+  std::vector<NdjsonMatch> out;
+  out.reserve(matches);
+  auto append = [&](size_t i) {
+    for (NdjsonMatch& match : batches[i].matches) {
+      match.line += first_line[i];
+      out.push_back(std::move(match));
+    }
+  };
+  if (options.ordered) {
+    for (size_t i = 0; i < batch_count; ++i) {
+      append(i);
+    }
+  } else {
+    for (const auto& worker : completed) {
+      std::for_each(worker.begin(), worker.end(), append);
+    }
+  }
+  return out;
+}
+
+std::vector<NdjsonMatch> select_ndjson_file(const std::string& file_path, const JsonPath& path,
+                                            const NdjsonOptions& options) {
+  detail::MappedFile file(file_path);
+  return select_ndjson(file.view(), path, options);
+}
+
+}  // namespace jsonpath
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+
+#include "jsonpath/json.hpp"
+
+namespace jsonpath {
+namespace detail {
+
+// Converts a token already validated against the JSON number grammar.
+// Integers without a fraction or exponent keep full 64-bit precision and
+// become int64_t (or uint64_t above INT64_MAX), except -0, which stays a
+// double so its sign survives; everything else, including
+// integers too wide for 64 bits, goes through std::from_chars, which is exact,
+// locale independent and allocation free. Returns false when the value does
+// not fit in a double.
+inline bool parse_number_token(std::string_view token, bool integral, Json& out) {
+  const char* first = token.data();
+  const char* last = token.data() + token.size();
+  if (integral) {
+    bool negative = *first == '-';
+    uint64_t magnitude = 0;
+    auto res = std::from_chars(first + (negative ? 1 : 0), last, magnitude);
+    if (res.ec == std::errc() && res.ptr == last) {
+      if (!negative) {
+        out = magnitude <= static_cast<uint64_t>(INT64_MAX) ? Json(static_cast<int64_t>(magnitude)) : Json(magnitude);
+        return true;
+      }
+      if (magnitude == 0) {
+        out = Json(-0.0);
+        return true;
+      }
+      if (magnitude <= static_cast<uint64_t>(INT64_MAX) + 1) {
+        out = Json(static_cast<int64_t>(0 - magnitude));
+        return true;
+      }
+    }
+  }
+  double value = 0;
+  auto res = std::from_chars(first, last, value);
+  if (res.ec != std::errc() || res.ptr != last) {
+    return false;
+  }
+  out = Json(value);
+  return true;
+}
+
+}  // namespace detail
+}  // namespace jsonpath
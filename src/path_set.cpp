@@ -0,0 +1,137 @@
+#include "jsonpath/jsonpath.hpp"
+
+#include "query.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <variant>
+#include <vector>
+
+namespace jsonpath {
+
+namespace {
+
+using detail::EvalContext;
+using detail::NodeList;
+using detail::ScopedNodeList;
+using detail::Segment;
+using detail::Selector;
+using detail::Slice;
+
+bool same_selector(const Selector& a, const Selector& b) {
+  if (a.node.index() != b.node.index()) {
+    return false;
+  }
+  if (const auto* name = std::get_if<Selector::Name>(&a.node)) {
+    return name->value == std::get<Selector::Name>(b.node).value;
+  }
+  if (const auto* index = std::get_if<Selector::Index>(&a.node)) {
+    return index->value == std::get<Selector::Index>(b.node).value;
+  }
+  if (const auto* slice = std::get_if<Selector::SliceSel>(&a.node)) {
+    const Slice& x = slice->value;
+    const Slice& y = std::get<Selector::SliceSel>(b.node).value;
+    return x.start == y.start && x.end == y.end && x.step == y.step;
+  }
+  return std::holds_alternative<Selector::Wildcard>(a.node);
+}
+
+// Whether two segments always select the same nodes. Filters are not
+// compared, so segments with one never count as the same.
+bool same_segment(const Segment& a, const Segment& b) {
+  if (a.descendant != b.descendant || a.selectors.size() != b.selectors.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.selectors.size(); ++i) {
+    if (!same_selector(a.selectors[i], b.selectors[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// Queries of a JsonPathSet merged on their leading segments. Each node stands
+// for the segment leading to it (none at the root) and lists the ids of the
+// queries that end there.
+struct detail::QueryTrie {
+  const Segment* segment = nullptr;
+  std::vector<size_t> ids;
+  std::vector<std::unique_ptr<QueryTrie>> children;
+};
+
+namespace {
+
+void eval_trie(const detail::QueryTrie& trie, const NodeList& input, const EvalContext& ctx,
+               const JsonPathSet::MatchCallback& on_match) {
+  for (const auto& child : trie.children) {
+    ScopedNodeList out(*ctx.buffers);
+    detail::apply_segment(*child->segment, input, ctx, *out);
+    if (out->empty()) {
+      continue;
+    }
+    for (size_t id : child->ids) {
+      on_match(id, *out);
+    }
+    eval_trie(*child, *out, ctx, on_match);
+  }
+}
+
+}  // namespace
+
+JsonPathSet::JsonPathSet() : trie_(std::make_unique<detail::QueryTrie>()) {}
+JsonPathSet::~JsonPathSet() = default;
+JsonPathSet::JsonPathSet(JsonPathSet&&) noexcept = default;
+JsonPathSet& JsonPathSet::operator=(JsonPathSet&&) noexcept = default;
+
+size_t JsonPathSet::add(const JsonPath& path) {
+  if (!path.impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  size_t id = paths_.size();
+  paths_.push_back(path);
+  hoisted_runs_ += path.impl_->query.hoisted_runs;
+  hoisted_values_ += path.impl_->query.hoisted_values;
+  detail::QueryTrie* node = trie_.get();
+  for (const Segment& segment : path.impl_->query.segments) {
+    auto it = std::find_if(node->children.begin(), node->children.end(),
+                           [&](const auto& child) { return same_segment(*child->segment, segment); });
+    if (it == node->children.end()) {
+      node->children.push_back(std::make_unique<detail::QueryTrie>());
+      node->children.back()->segment = &segment;
+      it = node->children.end() - 1;
+    }
+    node = it->get();
+  }
+  node->ids.push_back(id);
+  return id;
+}
+
+void JsonPathSet::evaluate(const Json& root, const MatchCallback& on_match) const {
+  EvalScratch scratch;
+  evaluate(root, on_match, scratch);
+}
+
+void JsonPathSet::evaluate(const Json& root, const MatchCallback& on_match, EvalScratch& scratch) const {
+  detail::EvalBuffers& buffers = *scratch.buffers_;
+  buffers.frames.clear();
+  buffers.reset_hoisted(hoisted_runs_, hoisted_values_);
+  EvalContext ctx{&root, &root, &buffers};
+  ScopedNodeList start(buffers);
+  start->push_back(&root);
+  for (size_t id : trie_->ids) {
+    on_match(id, *start);
+  }
+  eval_trie(*trie_, *start, ctx, on_match);
+}
+
+std::vector<std::vector<const Json*>> JsonPathSet::select(const Json& root) const {
+  std::vector<std::vector<const Json*>> out(paths_.size());
+  evaluate(root, [&](size_t id, const std::vector<const Json*>& matches) { out[id] = matches; });
+  return out;
+}
+
+}  // namespace jsonpath
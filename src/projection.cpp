@@ -0,0 +1,291 @@
+#include "jsonpath/projection.hpp"
+
+#include "json_writer.hpp"
+#include "query.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace jsonpath {
+
+namespace {
+
+using detail::Query;
+using detail::RawNodes;
+using detail::RawScanner;
+using detail::RawSpan;
+
+// Match locations for a Projection: for each match, the child positions
+// leading to it from the root, stored end to end in one buffer.
+struct ProjectionPaths {
+  std::vector<size_t> positions;
+  std::vector<std::pair<size_t, size_t>> paths;  // offset and length
+};
+
+void collect_paths(const Query& query, const Json& root, ProjectionPaths& out) {
+  detail::for_each_location(query, root, [&](const detail::PathStep* step) {
+    size_t offset = out.positions.size();
+    for (; step; step = step->parent) {
+      out.positions.push_back(step->position);
+    }
+    std::reverse(out.positions.begin() + static_cast<std::ptrdiff_t>(offset), out.positions.end());
+    out.paths.emplace_back(offset, out.positions.size() - offset);
+  });
+}
+
+// Visits the pruned document in document order. The visitor's open() starts
+// a container on the way to a match and close() ends the latest one; whole()
+// takes a match, or null when nothing matched in a scalar root. Both get the
+// parent and position (nullptr and 0 at the root) and, for whole(), the
+// parent's pointer to the node. A match inside another is skipped.
+template <typename Visitor>
+void walk_projection(const Json& root, ProjectionPaths& matches, Visitor& visitor) {
+  static const Json kNull;
+  const size_t* base = matches.positions.data();
+  auto before = [base](const auto& a, const auto& b) {
+    return std::lexicographical_compare(base + a.first, base + a.first + a.second, base + b.first,
+                                        base + b.first + b.second);
+  };
+  // A single query without unions already yields document order.
+  if (!std::is_sorted(matches.paths.begin(), matches.paths.end(), before)) {
+    std::sort(matches.paths.begin(), matches.paths.end(), before);
+  }
+  bool container = root.is_array() || root.is_object();
+  if ((!matches.paths.empty() && matches.paths.front().second == 0) || !container) {
+    visitor.whole(nullptr, 0, nullptr, matches.paths.empty() ? kNull : root);
+    return;
+  }
+  visitor.open(nullptr, 0, root);
+  std::vector<const Json*> open{&root};
+  const size_t* prev = nullptr;
+  size_t prev_size = 0;
+  for (const auto& [offset, size] : matches.paths) {
+    const size_t* path = base + offset;
+    size_t common = 0;
+    while (common < prev_size && common < size && prev[common] == path[common]) {
+      ++common;
+    }
+    if (prev && common == prev_size) {
+      continue;
+    }
+    while (open.size() > common + 1) {
+      visitor.close();
+      open.pop_back();
+    }
+    for (size_t k = common; k < size; ++k) {
+      const Json* parent = open.back();
+      const std::shared_ptr<Json>& child =
+          parent->is_array() ? parent->as_array()[path[k]] : parent->as_object().values()[path[k]];
+      if (k + 1 == size) {
+        visitor.whole(parent, path[k], &child, *child);
+      } else {
+        visitor.open(parent, path[k], *child);
+        open.push_back(child.get());
+      }
+    }
+    prev = path;
+    prev_size = size;
+  }
+  for (; !open.empty(); open.pop_back()) {
+    visitor.close();
+  }
+}
+
+class ProjectionWriter {
+ public:
+  explicit ProjectionWriter(detail::JsonWriter& writer) : writer_(writer) {}
+
+  void open(const Json* parent, size_t position, const Json& node) {
+    key(parent, position);
+    objects_.push_back(node.is_object());
+    if (node.is_object()) {
+      writer_.begin_object();
+    } else {
+      writer_.begin_array();
+    }
+  }
+
+  void whole(const Json* parent, size_t position, const std::shared_ptr<Json>*, const Json& node) {
+    key(parent, position);
+    writer_.value(node);
+  }
+
+  void close() {
+    if (objects_.back()) {
+      writer_.end_object();
+    } else {
+      writer_.end_array();
+    }
+    objects_.pop_back();
+  }
+
+ private:
+  detail::JsonWriter& writer_;
+  std::vector<bool> objects_;
+
+  void key(const Json* parent, size_t position) {
+    if (parent && parent->is_object()) {
+      writer_.key(parent->as_object().keys()[position].view());
+    }
+  }
+};
+
+class ProjectionBuilder {
+ public:
+  Json result;
+
+  void open(const Json* parent, size_t position, const Json& node) {
+    Json container = node.is_object() ? Json(Json::Object()) : Json(Json::Array());
+    if (!parent) {
+      result = std::move(container);
+      building_.push_back(&result);
+      return;
+    }
+    auto child = std::make_shared<Json>(std::move(container));
+    add(parent, position, child);
+    building_.push_back(child.get());
+  }
+
+  void whole(const Json* parent, size_t position, const std::shared_ptr<Json>* source, const Json& node) {
+    if (!parent) {
+      result = node;
+      return;
+    }
+    add(parent, position, *source);
+  }
+
+  void close() { building_.pop_back(); }
+
+ private:
+  std::vector<Json*> building_;
+
+  void add(const Json* parent, size_t position, std::shared_ptr<Json> child) {
+    Json& target = *building_.back();
+    if (target.is_array()) {
+      target.as_array().push_back(std::move(child));
+    } else {
+      target.as_object().insert_or_assign(parent->as_object().keys()[position].view(), std::move(child));
+    }
+  }
+};
+
+// Writes the part of the value at span holding matches[first, last), which
+// are sorted, do not overlap and all lie within span. Members and elements
+// after the last match are not scanned.
+void write_raw_projection(std::string_view input, RawScanner& scanner, RawSpan span, const RawNodes& matches,
+                          size_t first, size_t last, detail::JsonWriter& writer) {
+  if (last == first + 1 && matches[first].begin == span.begin && matches[first].end == span.end) {
+    std::string_view text = input.substr(span.begin, span.end - span.begin);
+    size_t begin = text.find_first_not_of(" \t\n\r");
+    size_t end = text.find_last_not_of(" \t\n\r");
+    writer.raw_value(begin == std::string_view::npos ? text : text.substr(begin, end + 1 - begin));
+    return;
+  }
+  scanner.seek(span.begin);
+  char kind = scanner.kind();
+  size_t next = first;
+  auto inside = [&](RawSpan value) {
+    size_t end = next;
+    while (end < last && matches[end].begin < value.end) {
+      ++end;
+    }
+    return end;
+  };
+  if (kind == '{') {
+    writer.begin_object();
+    scanner.members([&](std::string_view key, bool) {
+      RawSpan value = scanner.value();
+      size_t end = inside(value);
+      if (end > next) {
+        writer.raw_key(std::string_view(key.data() - 1, key.size() + 2));
+        write_raw_projection(input, scanner, value, matches, next, end, writer);
+        scanner.seek(value.end);
+        next = end;
+      }
+      return next < last;
+    });
+    writer.end_object();
+  } else if (kind == '[') {
+    writer.begin_array();
+    scanner.elements([&] {
+      RawSpan value = scanner.value();
+      size_t end = inside(value);
+      if (end > next) {
+        write_raw_projection(input, scanner, value, matches, next, end, writer);
+        scanner.seek(value.end);
+        next = end;
+      }
+      return next < last;
+    });
+    writer.end_array();
+  } else {
+    writer.value(Json());
+  }
+}
+
+}  // namespace
+
+Projection::Projection(std::vector<JsonPath> paths) : paths_(std::move(paths)) {
+  for (const JsonPath& path : paths_) {
+    if (!path.impl_) {
+      throw std::runtime_error("JsonPath is not compiled");
+    }
+  }
+}
+
+Json Projection::project(const Json& root) const {
+  ProjectionPaths matches;
+  for (const JsonPath& path : paths_) {
+    collect_paths(path.impl_->query, root, matches);
+  }
+  ProjectionBuilder builder;
+  walk_projection(root, matches, builder);
+  return std::move(builder.result);
+}
+
+void Projection::project(const Json& root, Sink& sink, const SerializeOptions& options) const {
+  ProjectionPaths matches;
+  for (const JsonPath& path : paths_) {
+    collect_paths(path.impl_->query, root, matches);
+  }
+  detail::JsonWriter writer(sink, options);
+  ProjectionWriter visitor(writer);
+  walk_projection(root, matches, visitor);
+  sink.flush();
+}
+
+void Projection::project_raw(std::string_view json, Sink& sink, const SerializeOptions& options) const {
+  for (const JsonPath& path : paths_) {
+    if (!path.impl_->raw) {
+      project(parse_json(json), sink, options);
+      return;
+    }
+  }
+  RawNodes matches;
+  for (const JsonPath& path : paths_) {
+    RawNodes nodes = eval_raw(path.impl_->query, json);
+    matches.insert(matches.end(), nodes.begin(), nodes.end());
+  }
+  // Outermost first, then drop matches inside another.
+  std::sort(matches.begin(), matches.end(), [](const RawSpan& a, const RawSpan& b) {
+    return a.begin != b.begin ? a.begin < b.begin : a.end > b.end;
+  });
+  size_t kept = 0;
+  for (const RawSpan& match : matches) {
+    if (kept == 0 || match.begin >= matches[kept - 1].end) {
+      matches[kept++] = match;
+    }
+  }
+  matches.resize(kept);
+  detail::JsonWriter writer(sink, options);
+  RawScanner scanner(json);
+  write_raw_projection(json, scanner, RawSpan{0, json.size()}, matches, 0, matches.size(), writer);
+  sink.flush();
+}
+
+}  // namespace jsonpath
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "jsonpath/json.hpp"
+#include "jsonpath/jsonpath.hpp"
+
+#include "raw_scanner.hpp"
+
+// Compiled queries and the pieces of their evaluation shared by the source
+// files that run them (JsonPath, JsonPathSet, Projection and select_stream).
+namespace jsonpath {
+namespace detail {
+
+struct HoistedValue;
+
+// Node lists are handed out and returned in LIFO order as evaluation nests
+// into filters, so each level reuses the same few vectors.
+class EvalBuffers {
+ public:
+  struct Frame {
+    const std::shared_ptr<Json>* next;
+    const std::shared_ptr<Json>* end;
+  };
+
+  std::vector<const Json*>& acquire() {
+    if (used_ == lists_.size()) {
+      lists_.push_back(std::make_unique<std::vector<const Json*>>());
+    }
+    std::vector<const Json*>& list = *lists_[used_++];
+    list.clear();
+    return list;
+  }
+
+  void release() { --used_; }
+
+  // Stack for descendant walks. A walk nested inside a filter pushes above
+  // the frames of the walk it interrupts and pops back down to them.
+  std::vector<Frame> frames;
+
+  // Hoisted filter operands (see FilterProgram) of the evaluation under way,
+  // whose root is fixed: a run of values per filter program, filled in the
+  // first time the program runs and keyed by its address. reset_hoisted
+  // reserves room for every program of the query up front, so the values
+  // never move while the filters using them run.
+  std::vector<std::pair<const void*, size_t>> hoisted_runs;
+  std::vector<HoistedValue> hoisted;
+
+  EvalBuffers();
+  ~EvalBuffers();
+  void reset_hoisted(size_t runs, size_t values);
+
+ private:
+  std::vector<std::unique_ptr<std::vector<const Json*>>> lists_;
+  size_t used_ = 0;
+};
+
+// One step of a match location: the child at position in container.
+struct PathStep {
+  const PathStep* parent;
+  const Json* container;
+  size_t position;
+};
+
+struct Slice {
+  std::optional<int64_t> start;
+  std::optional<int64_t> end;
+  std::optional<int64_t> step;
+};
+
+struct Expr;
+struct Query;
+struct FunctionExpr;
+
+enum class CompareOp {
+  Eq,
+  Ne,
+  Lt,
+  Lte,
+  Gt,
+  Gte,
+};
+
+// A filter expression lowered to a flat program, run by run_filter() for
+// every candidate node. Each instruction leaves its result in one flag; &&
+// and || become jumps over their right-hand side. Operands are indices into
+// side tables that point back into the expression tree, and singular queries
+// are spelled out as name and index steps so they resolve without the
+// general segment evaluator. Comparisons between literals are folded into
+// constants, and operands that only depend on the root are hoisted: they are
+// evaluated once per evaluation of the whole query, when the filter first
+// runs, and kept in EvalBuffers.
+struct FilterProgram {
+  enum class Op : uint8_t { Compare, Test, Not, JumpIfFalse, JumpIfTrue, Constant };
+  enum class Source : uint8_t { Literal, Path, Query, Function, Hoisted };
+
+  struct Operand {
+    uint32_t index;
+    Source source;
+  };
+
+  // For jumps, right.index is the target; for Constant, left.index is the
+  // result.
+  struct Instruction {
+    Operand left;
+    Operand right;
+    Op op;
+    CompareOp cmp;
+  };
+
+  struct Step {
+    std::string_view name;
+    size_t hash;
+    int64_t index;
+    bool is_name;
+  };
+
+  struct Path {
+    uint32_t first;
+    uint32_t count;
+    bool absolute;
+  };
+
+  std::vector<Instruction> code;
+  std::vector<const Json*> literals;
+  std::vector<Step> steps;
+  std::vector<Path> paths;
+  std::vector<const Query*> queries;
+  std::vector<const FunctionExpr*> functions;
+  // Operands replaced by Source::Hoisted, and whether each is tested rather
+  // than compared.
+  std::vector<std::pair<Operand, bool>> hoisted;
+};
+
+struct Selector {
+  // hash is JsonObject::hash_key(value), worked out once when compiled.
+  struct Name { std::string value; size_t hash; };
+  struct Wildcard {};
+  struct Index { int64_t value; };
+  struct SliceSel { Slice value; };
+  struct Filter { std::unique_ptr<Expr> expr; FilterProgram program; };
+
+  std::variant<Name, Wildcard, Index, SliceSel, Filter> node;
+};
+
+struct Segment {
+  bool descendant = false;
+  std::vector<Selector> selectors;
+};
+
+struct Query {
+  bool absolute = true;
+  bool singular = true;
+  std::vector<Segment> segments;
+  // For a whole compiled query: the filter programs with hoisted operands,
+  // nested ones included, and their total number of hoisted operands.
+  size_t hoisted_runs = 0;
+  size_t hoisted_values = 0;
+};
+
+struct Literal {
+  Json value;
+};
+
+struct Comparable {
+  std::variant<Literal, Query, std::unique_ptr<FunctionExpr>> node;
+};
+
+struct TestItem {
+  std::variant<Query, std::unique_ptr<FunctionExpr>> node;
+};
+
+struct Expr {
+  struct Or { std::unique_ptr<Expr> left; std::unique_ptr<Expr> right; };
+  struct And { std::unique_ptr<Expr> left; std::unique_ptr<Expr> right; };
+  struct Not { std::unique_ptr<Expr> expr; };
+  struct Comparison { Comparable left; CompareOp op; Comparable right; };
+  struct Test { TestItem item; };
+
+  std::variant<Or, And, Not, Comparison, Test> node;
+};
+
+struct EvalContext {
+  const Json* root = nullptr;
+  const Json* current = nullptr;
+  EvalBuffers* buffers = nullptr;
+  // Values of the hoisted operands of the filter being run.
+  const HoistedValue* hoisted = nullptr;
+};
+
+using NodeList = std::vector<const Json*>;
+
+// A node list borrowed from EvalBuffers until the end of the scope.
+class ScopedNodeList {
+ public:
+  explicit ScopedNodeList(EvalBuffers& buffers) : buffers_(buffers), list_(buffers.acquire()) {}
+  ~ScopedNodeList() { buffers_.release(); }
+  ScopedNodeList(const ScopedNodeList&) = delete;
+  ScopedNodeList& operator=(const ScopedNodeList&) = delete;
+
+  NodeList& operator*() const { return list_; }
+  NodeList* operator->() const { return &list_; }
+
+ private:
+  EvalBuffers& buffers_;
+  NodeList& list_;
+};
+
+// Appends the nodes segment selects from input to out.
+void apply_segment(const Segment& segment, const NodeList& input, const EvalContext& ctx, NodeList& out);
+// Applies query.segments[first..] starting from start and leaves the result
+// in out.
+void eval_segments(const Query& query, size_t first, const Json* start, const EvalContext& ctx, NodeList& out);
+// Whether ctx.current passes the filter.
+bool run_filter(const FilterProgram& program, const EvalContext& ctx);
+bool expr_uses_root(const Expr& expr);
+
+// Calls on_match with the location of each node query selects from root, in
+// the order select() returns them; root itself comes as nullptr.
+using LocationCallback = std::function<void(const PathStep* step)>;
+void for_each_location(const Query& query, const Json& root, const LocationCallback& on_match);
+
+// The spans of the matches of a query that JsonPath::Impl::raw allows.
+using RawNodes = std::vector<RawSpan>;
+RawNodes eval_raw(const Query& query, std::string_view input);
+
+}  // namespace detail
+
+struct JsonPath::Impl {
+  detail::Query query;
+  // Whether select_raw can evaluate query over unparsed text.
+  bool raw = false;
+};
+
+}  // namespace jsonpath
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "structural_index.hpp"
+
+namespace jsonpath {
+namespace detail {
+
+// A value in unparsed JSON text: [begin, end) of the input.
+struct RawSpan {
+  size_t begin;
+  size_t end;
+};
+
+// A cursor over unparsed JSON text that steps through the members of objects
+// and arrays, using one structural index for the whole text to step over
+// whitespace and skip nested containers without building nodes. Only the
+// bytes needed to find member boundaries are looked at, so malformed JSON
+// inside skipped values goes undetected. The cursor mostly moves forward;
+// seek() can take it back to a value seen before, which is cheap while the
+// value is still in the index's current window.
+class RawScanner {
+ public:
+  explicit RawScanner(std::string_view input) : input_(input), index_(input) {}
+
+  void seek(size_t pos) {
+    pos_ = pos;
+    index_.seek(pos);
+  }
+
+  // Skips whitespace; the cursor is then on the value, at position().
+  char kind() {
+    skip_ws();
+    return peek();
+  }
+
+  size_t position() const { return pos_; }
+
+  // For the object at the cursor, calls visit(key, key_escaped) with the
+  // cursor on each member's value until it returns false; key is the raw text
+  // between the quotes. To go on, visit must step over the value, with
+  // value() or otherwise, before returning true.
+  template <typename Visit>
+  void members(Visit visit) {
+    ++pos_;
+    skip_ws();
+    if (peek() == '}') {
+      ++pos_;
+      return;
+    }
+    while (true) {
+      size_t close = 0;
+      bool dirty = false;
+      if (peek() != '"' || !index_.string_end(pos_, close, dirty)) {
+        throw error("Expected string key");
+      }
+      std::string_view key = input_.substr(pos_ + 1, close - pos_ - 1);
+      pos_ = close + 1;
+      skip_ws();
+      if (peek() != ':') {
+        throw error("Expected ':' after key");
+      }
+      ++pos_;
+      if (!visit(key, dirty)) {
+        return;
+      }
+      if (!next_member('}')) {
+        return;
+      }
+    }
+  }
+
+  // As members, calling visit() with the cursor on each element.
+  template <typename Visit>
+  void elements(Visit visit) {
+    ++pos_;
+    skip_ws();
+    if (peek() == ']') {
+      ++pos_;
+      return;
+    }
+    while (true) {
+      if (!visit()) {
+        return;
+      }
+      if (!next_member(']')) {
+        return;
+      }
+    }
+  }
+
+  // Steps over the value at the cursor and returns its span.
+  RawSpan value() {
+    skip_ws();
+    size_t begin = pos_;
+    char c = peek();
+    if (c == '"') {
+      size_t close = 0;
+      bool dirty = false;
+      if (!index_.string_end(pos_, close, dirty)) {
+        throw error("Unterminated string");
+      }
+      pos_ = close + 1;
+    } else if (c == '{' || c == '[') {
+      size_t close = index_.container_end(pos_);
+      if (close == input_.size()) {
+        throw error("Unexpected end of input");
+      }
+      pos_ = close + 1;
+    } else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+      pos_ = index_.next(pos_ + 1);
+      while (is_ws(input_[pos_ - 1])) {
+        --pos_;
+      }
+    } else {
+      throw error("Invalid JSON value");
+    }
+    return RawSpan{begin, pos_};
+  }
+
+ private:
+  std::string_view input_;
+  size_t pos_ = 0;
+  StructuralIndex index_;
+
+  static bool is_ws(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+
+  void skip_ws() {
+    if (pos_ < input_.size() && is_ws(input_[pos_])) {
+      pos_ = index_.next(pos_ + 1);
+    }
+  }
+
+  char peek() const {
+    return pos_ < input_.size() ? input_[pos_] : '\0';
+  }
+
+  bool next_member(char close) {
+    skip_ws();
+    char c = peek();
+    ++pos_;
+    if (c == ',') {
+      skip_ws();
+      return true;
+    }
+    if (c != close) {
+      --pos_;
+      throw error(close == '}' ? "Expected ',' or '}' in object" : "Expected ',' or ']' in array");
+    }
+    return false;
+  }
+
+  std::runtime_error error(const char* message) const {
+    return std::runtime_error(std::string(message) + " at position " + std::to_string(pos_));
+  }
+};
+
+}  // namespace detail
+}  // namespace jsonpath
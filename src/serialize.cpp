@@ -0,0 +1,356 @@
+#include "jsonpath/serialize.hpp"
+
+#include "json_writer.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSONPATH_X86 1
+#endif
+
+namespace jsonpath {
+namespace {
+
+bool needs_escape(unsigned char c) {
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Each kernel returns the length of the leading run of data that can be
+// copied out unchanged.
+using ScanFn = size_t (*)(const char* data, size_t size);
+
+size_t scan_scalar(const char* data, size_t size) {
+  size_t i = 0;
+  while (i < size && !needs_escape(static_cast<unsigned char>(data[i]))) {
+    ++i;
+  }
+  return i;
+}
+
+#ifdef JSONPATH_X86
+
+__attribute__((target("sse2"))) size_t scan_sse2(const char* data, size_t size) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+    if (int mask = _mm_movemask_epi8(special)) {
+      return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+    }
+  }
+  return i + scan_scalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) size_t scan_avx2(const char* data, size_t size) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+    special = _mm256_or_si256(special, _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+    if (uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(special))) {
+      return i + static_cast<size_t>(__builtin_ctz(mask));
+    }
+  }
+  // A 16-byte step compiled here is VEX-encoded; calling scan_sse2 with the
+  // upper halves of the registers dirty would stall on the SSE transition.
+  if (i + 16 <= size) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(quote)),
+                                   _mm_cmpeq_epi8(v, _mm256_castsi256_si128(backslash)));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(v, _mm256_castsi256_si128(control)), v));
+    if (int mask = _mm_movemask_epi8(special)) {
+      return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+    }
+    i += 16;
+  }
+  return i + scan_scalar(data + i, size - i);
+}
+
+#endif
+
+ScanFn select_scan() {
+#ifdef JSONPATH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return scan_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return scan_sse2;
+  }
+#endif
+  return scan_scalar;
+}
+
+// Selected on first use rather than by a static initializer, so that writing
+// JSON from another file's static initializers works too.
+size_t scan(const char* data, size_t size) {
+  static const ScanFn selected = select_scan();
+  return selected(data, size);
+}
+
+}  // namespace
+
+namespace detail {
+
+void JsonWriter::value(const Json& value) {
+  separate();
+  write(value, depth_);
+}
+
+void JsonWriter::raw_value(std::string_view text) {
+  separate();
+  sink_.write(text);
+}
+
+void JsonWriter::begin_array() {
+  separate();
+  sink_.put('[');
+  ++depth_;
+  first_ = true;
+}
+
+void JsonWriter::end_array() {
+  close(']');
+}
+
+void JsonWriter::begin_object() {
+  separate();
+  sink_.put('{');
+  ++depth_;
+  first_ = true;
+}
+
+void JsonWriter::end_object() {
+  close('}');
+}
+
+void JsonWriter::key(std::string_view name) {
+  separate();
+  write_string(name);
+  sink_.write(options_.pretty ? std::string_view(": ") : std::string_view(":"));
+  after_key_ = true;
+}
+
+void JsonWriter::raw_key(std::string_view quoted) {
+  separate();
+  sink_.write(quoted);
+  sink_.write(options_.pretty ? std::string_view(": ") : std::string_view(":"));
+  after_key_ = true;
+}
+
+void JsonWriter::separate() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (depth_ == 0) {
+    return;
+  }
+  if (!first_) {
+    sink_.put(',');
+  }
+  first_ = false;
+  if (options_.pretty) {
+    newline(depth_);
+  }
+}
+
+void JsonWriter::close(char bracket) {
+  --depth_;
+  if (!first_ && options_.pretty) {
+    newline(depth_);
+  }
+  sink_.put(bracket);
+  first_ = false;
+}
+
+void JsonWriter::write(const Json& value, size_t depth) {
+  std::visit(
+      [&](const auto& v) {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, std::nullptr_t>) {
+          sink_.write("null");
+        } else if constexpr (std::is_same_v<T, bool>) {
+          sink_.write(v ? "true" : "false");
+        } else if constexpr (std::is_same_v<T, double>) {
+          write_double(v);
+        } else if constexpr (std::is_same_v<T, int64_t> || std::is_same_v<T, uint64_t>) {
+          char buffer[24];
+          sink_.write(std::string_view(buffer, static_cast<size_t>(std::to_chars(buffer, buffer + 24, v).ptr - buffer)));
+        } else if constexpr (std::is_same_v<T, Json::String> || std::is_same_v<T, std::string_view>) {
+          write_string(v);
+        } else if constexpr (std::is_same_v<T, Json::Array>) {
+          write_array(v, depth);
+        } else {
+          write_object(v, depth);
+        }
+      },
+      value.value);
+}
+
+void JsonWriter::write_double(double d) {
+  if (!std::isfinite(d)) {
+    throw std::invalid_argument("to_json: cannot write NaN or infinity");
+  }
+  char buffer[32];
+  char* end = std::to_chars(buffer, buffer + 30, d).ptr;
+  bool integral = true;
+  for (const char* p = buffer; p != end; ++p) {
+    if (*p == '.' || *p == 'e') {
+      integral = false;
+      break;
+    }
+  }
+  if (integral) {
+    *end++ = '.';
+    *end++ = '0';
+  }
+  sink_.write(std::string_view(buffer, static_cast<size_t>(end - buffer)));
+}
+
+void JsonWriter::write_string(std::string_view s) {
+  static const char kHex[] = "0123456789abcdef";
+  sink_.put('"');
+  while (!s.empty()) {
+    size_t clean = scan(s.data(), s.size());
+    sink_.write(s.substr(0, clean));
+    if (clean == s.size()) {
+      break;
+    }
+    unsigned char c = static_cast<unsigned char>(s[clean]);
+    switch (c) {
+      case '"': sink_.write("\\\""); break;
+      case '\\': sink_.write("\\\\"); break;
+      case '\b': sink_.write("\\b"); break;
+      case '\f': sink_.write("\\f"); break;
+      case '\n': sink_.write("\\n"); break;
+      case '\r': sink_.write("\\r"); break;
+      case '\t': sink_.write("\\t"); break;
+      default: {
+        char escape[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xF]};
+        sink_.write(std::string_view(escape, 6));
+      }
+    }
+    s.remove_prefix(clean + 1);
+  }
+  sink_.put('"');
+}
+
+void JsonWriter::newline(size_t depth) {
+  static const char kSpaces[] = "                                                                ";
+  sink_.put('\n');
+  for (size_t n = depth * options_.indent; n > 0;) {
+    size_t chunk = std::min(n, sizeof(kSpaces) - 1);
+    sink_.write(std::string_view(kSpaces, chunk));
+    n -= chunk;
+  }
+}
+
+void JsonWriter::write_array(const Json::Array& array, size_t depth) {
+  if (array.empty()) {
+    sink_.write("[]");
+    return;
+  }
+  sink_.put('[');
+  for (size_t i = 0; i < array.size(); ++i) {
+    if (i > 0) {
+      sink_.put(',');
+    }
+    if (options_.pretty) {
+      newline(depth + 1);
+    }
+    write(*array[i], depth + 1);
+  }
+  if (options_.pretty) {
+    newline(depth);
+  }
+  sink_.put(']');
+}
+
+void JsonWriter::write_object(const Json::Object& object, size_t depth) {
+  if (object.empty()) {
+    sink_.write("{}");
+    return;
+  }
+  sink_.put('{');
+  for (size_t i = 0; i < object.size(); ++i) {
+    if (i > 0) {
+      sink_.put(',');
+    }
+    if (options_.pretty) {
+      newline(depth + 1);
+    }
+    write_string(object.keys()[i].view());
+    sink_.write(options_.pretty ? std::string_view(": ") : std::string_view(":"));
+    write(*object.values()[i], depth + 1);
+  }
+  if (options_.pretty) {
+    newline(depth);
+  }
+  sink_.put('}');
+}
+
+}  // namespace detail
+
+Sink::Sink(size_t capacity) : buffer_(new char[capacity > 0 ? capacity : 1]), capacity_(capacity > 0 ? capacity : 1) {}
+
+void Sink::flush() {
+  if (size_ > 0) {
+    size_t size = size_;
+    size_ = 0;
+    flush_bytes(buffer_.get(), size);
+  }
+}
+
+void Sink::write_slow(std::string_view s) {
+  flush();
+  if (s.size() >= capacity_) {
+    flush_bytes(s.data(), s.size());
+    return;
+  }
+  std::memcpy(buffer_.get(), s.data(), s.size());
+  size_ = s.size();
+}
+
+void FdSink::flush_bytes(const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd_, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Cannot write: ") + std::strerror(errno));
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+void to_json(const Json& value, Sink& sink, const SerializeOptions& options) {
+  detail::JsonWriter(sink, options).value(value);
+  sink.flush();
+}
+
+std::string to_json(const Json& value, const SerializeOptions& options) {
+  std::string out;
+  StringSink sink(out);
+  to_json(value, sink, options);
+  return out;
+}
+
+}  // namespace jsonpath
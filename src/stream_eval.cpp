@@ -0,0 +1,203 @@
+#include "jsonpath/jsonpath.hpp"
+
+#include "json_stream.hpp"
+#include "query.hpp"
+
+#include <cstddef>
+#include <istream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+
+namespace jsonpath {
+
+namespace {
+
+using detail::EvalContext;
+using detail::Query;
+using detail::ScopedNodeList;
+using detail::Segment;
+using detail::Selector;
+using detail::Slice;
+
+// Drives a query over a JsonStreamReader. Segments with a single selector
+// that visits children in document order are evaluated while streaming, so
+// unselected members are skipped without being kept; anything else
+// (unions, negative indices and steps, descendant segments) materializes the
+// node it applies to and finishes on the tree. Filters materialize one
+// candidate at a time.
+class StreamEvaluator {
+ public:
+  StreamEvaluator(const Query& query, detail::JsonStreamReader& reader, const JsonPath::MatchCallback& on_match)
+      : query_(query), reader_(reader), on_match_(on_match) {}
+
+  void run() {
+    reader_.skip_ws();
+    visit(0);
+    reader_.skip_ws();
+    if (!reader_.at_end()) {
+      throw reader_.error("Unexpected trailing characters");
+    }
+  }
+
+ private:
+  const Query& query_;
+  detail::JsonStreamReader& reader_;
+  const JsonPath::MatchCallback& on_match_;
+  std::string text_;
+  detail::EvalBuffers buffers_;
+
+  static bool streamable(const Segment& segment) {
+    if (segment.descendant || segment.selectors.size() != 1) {
+      return false;
+    }
+    const auto& node = segment.selectors.front().node;
+    if (const auto* index = std::get_if<Selector::Index>(&node)) {
+      return index->value >= 0;
+    }
+    if (const auto* slice = std::get_if<Selector::SliceSel>(&node)) {
+      const Slice& s = slice->value;
+      return s.step.value_or(1) > 0 && s.start.value_or(0) >= 0 && s.end.value_or(0) >= 0;
+    }
+    return true;
+  }
+
+  Json materialize() {
+    text_.clear();
+    reader_.capture_value(text_);
+    return parse_json(text_);
+  }
+
+  void finish(const Json& node, size_t seg) {
+    EvalContext ctx{&node, &node, &buffers_};
+    ScopedNodeList matches(buffers_);
+    detail::eval_segments(query_, seg, &node, ctx, *matches);
+    for (const Json* match : *matches) {
+      on_match_(*match);
+    }
+  }
+
+  // The reader is at the value reached by the first seg segments.
+  void visit(size_t seg) {
+    if (seg == query_.segments.size() || !streamable(query_.segments[seg])) {
+      finish(materialize(), seg);
+      return;
+    }
+    const auto& selector = query_.segments[seg].selectors.front().node;
+    if (const auto* name = std::get_if<Selector::Name>(&selector)) {
+      bool found = false;
+      children([&](std::string_view key, size_t) {
+        if (!found && key == name->value) {
+          found = true;
+          visit(seg + 1);
+        } else {
+          reader_.skip_value();
+        }
+      }, false, true);
+      return;
+    }
+    if (std::holds_alternative<Selector::Wildcard>(selector)) {
+      children([&](std::string_view, size_t) { visit(seg + 1); }, true, true);
+      return;
+    }
+    if (const auto* index = std::get_if<Selector::Index>(&selector)) {
+      size_t target = static_cast<size_t>(index->value);
+      children([&](std::string_view, size_t i) {
+        if (i == target) {
+          visit(seg + 1);
+        } else {
+          reader_.skip_value();
+        }
+      }, true, false);
+      return;
+    }
+    if (const auto* slice = std::get_if<Selector::SliceSel>(&selector)) {
+      size_t start = static_cast<size_t>(slice->value.start.value_or(0));
+      size_t step = static_cast<size_t>(slice->value.step.value_or(1));
+      std::optional<int64_t> end = slice->value.end;
+      children([&](std::string_view, size_t i) {
+        if (i >= start && (!end || i < static_cast<size_t>(*end)) && (i - start) % step == 0) {
+          visit(seg + 1);
+        } else {
+          reader_.skip_value();
+        }
+      }, true, false);
+      return;
+    }
+    const auto& filter = std::get<Selector::Filter>(selector);
+    children([&](std::string_view, size_t) {
+      Json candidate = materialize();
+      EvalContext ctx{&candidate, &candidate, &buffers_};
+      if (detail::run_filter(filter.program, ctx)) {
+        finish(candidate, seg + 1);
+      }
+    }, true, true);
+  }
+
+  // Calls visit(key, index) with the reader at each child's value of an array
+  // or object (as enabled); visit must consume it. Any other value is skipped.
+  template <typename Visit>
+  void children(Visit visit, bool arrays, bool objects) {
+    char open = reader_.peek();
+    if (!(open == '[' && arrays) && !(open == '{' && objects)) {
+      reader_.skip_value();
+      return;
+    }
+    char close = open == '{' ? '}' : ']';
+    reader_.expect(open, "Invalid JSON value");
+    reader_.skip_ws();
+    if (reader_.peek() == close) {
+      reader_.expect(close, "Unexpected end of input");
+      return;
+    }
+    for (size_t i = 0;; ++i) {
+      reader_.skip_ws();
+      std::string_view key;
+      if (open == '{') {
+        key = reader_.read_key();
+        reader_.skip_ws();
+        reader_.expect(':', "Expected ':' after key");
+        reader_.skip_ws();
+      }
+      visit(key, i);
+      reader_.skip_ws();
+      if (reader_.peek() == ',') {
+        reader_.expect(',', "Unexpected end of input");
+        continue;
+      }
+      reader_.expect(close, open == '{' ? "Expected ',' or '}' in object" : "Expected ',' or ']' in array");
+      return;
+    }
+  }
+};
+
+}  // namespace
+
+void JsonPath::select_stream(const ChunkSource& source, const MatchCallback& on_match) const {
+  if (!impl_) {
+    throw std::runtime_error("JsonPath is not compiled");
+  }
+  for (const auto& segment : impl_->query.segments) {
+    for (const auto& selector : segment.selectors) {
+      const auto* filter = std::get_if<Selector::Filter>(&selector.node);
+      if (filter && detail::expr_uses_root(*filter->expr)) {
+        throw std::runtime_error("select_stream: filters cannot refer to the root");
+      }
+    }
+  }
+  detail::JsonStreamReader reader(source);
+  StreamEvaluator(impl_->query, reader, on_match).run();
+}
+
+void JsonPath::select_stream(std::istream& in, const MatchCallback& on_match) const {
+  select_stream(
+      [&in](char* buffer, size_t capacity) {
+        in.read(buffer, static_cast<std::streamsize>(capacity));
+        return static_cast<size_t>(in.gcount());
+      },
+      on_match);
+}
+
+}  // namespace jsonpath
@@ -0,0 +1,303 @@
+#include "structural_index.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSONPATH_X86 1
+#endif
+
+namespace jsonpath {
+namespace detail {
+namespace {
+
+constexpr uint64_t kEvenBits = 0x5555555555555555ULL;
+constexpr uint64_t kOddBits = ~kEvenBits;
+
+void classify_scalar(const char* block, BlockMasks& masks) {
+  BlockMasks m;
+  for (int i = 0; i < 64; ++i) {
+    unsigned char c = static_cast<unsigned char>(block[i]);
+    uint64_t bit = 1ULL << i;
+    if (c == '"') {
+      m.quote |= bit;
+    } else if (c == '\\') {
+      m.backslash |= bit;
+    } else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',') {
+      m.op |= bit;
+    }
+    if (c == ' ' || (c >= '\t' && c <= '\r')) {
+      m.whitespace |= bit;
+    }
+    if (c < 0x20) {
+      m.control |= bit;
+    }
+  }
+  masks = m;
+}
+
+#ifdef JSONPATH_X86
+
+__attribute__((target("sse2"))) inline __m128i eq_sse2(__m128i v, char c) {
+  return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+__attribute__((target("avx2"))) inline __m256i eq_avx2(__m256i v, char c) {
+  return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+__attribute__((target("sse2"))) void classify_sse2(const char* block, BlockMasks& masks) {
+  BlockMasks m;
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+    __m128i braces = _mm_or_si128(eq_sse2(v, '{'), eq_sse2(v, '}'));
+    __m128i brackets = _mm_or_si128(eq_sse2(v, '['), eq_sse2(v, ']'));
+    __m128i separators = _mm_or_si128(eq_sse2(v, ':'), eq_sse2(v, ','));
+    __m128i op = _mm_or_si128(braces, _mm_or_si128(brackets, separators));
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ws = _mm_or_si128(eq_sse2(v, ' '), _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+    int shift = 16 * i;
+    m.quote |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(eq_sse2(v, '"')))) << shift;
+    m.backslash |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(eq_sse2(v, '\\')))) << shift;
+    m.op |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(op))) << shift;
+    m.whitespace |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(ws))) << shift;
+    m.control |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(ctrl))) << shift;
+  }
+  masks = m;
+}
+
+__attribute__((target("avx2"))) void classify_avx2(const char* block, BlockMasks& masks) {
+  BlockMasks m;
+  for (int i = 0; i < 2; ++i) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+    __m256i braces = _mm256_or_si256(eq_avx2(v, '{'), eq_avx2(v, '}'));
+    __m256i brackets = _mm256_or_si256(eq_avx2(v, '['), eq_avx2(v, ']'));
+    __m256i separators = _mm256_or_si256(eq_avx2(v, ':'), eq_avx2(v, ','));
+    __m256i op = _mm256_or_si256(braces, _mm256_or_si256(brackets, separators));
+    __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i ws = _mm256_or_si256(eq_avx2(v, ' '), _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted));
+    __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v);
+    int shift = 32 * i;
+    m.quote |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq_avx2(v, '"')))) << shift;
+    m.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq_avx2(v, '\\')))) << shift;
+    m.op |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << shift;
+    m.whitespace |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(ws))) << shift;
+    m.control |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(ctrl))) << shift;
+  }
+  masks = m;
+}
+
+#endif
+
+struct Kernel {
+  ClassifyFn fn;
+  const char* name;
+};
+
+Kernel select_kernel() {
+#ifdef JSONPATH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {classify_avx2, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {classify_sse2, "sse2"};
+  }
+#endif
+  return {classify_scalar, "scalar"};
+}
+
+const Kernel& kernel() {
+  static const Kernel selected = select_kernel();
+  return selected;
+}
+
+// Marks the bytes escaped by an odd-length run of backslashes, carrying runs
+// that end a block into the next one.
+uint64_t find_escaped(uint64_t backslash, uint64_t& prev_odd_run) {
+  uint64_t start_edges = backslash & ~(backslash << 1);
+  uint64_t even_start_mask = kEvenBits ^ prev_odd_run;
+  uint64_t even_starts = start_edges & even_start_mask;
+  uint64_t odd_starts = start_edges & ~even_start_mask;
+  uint64_t even_carries = backslash + even_starts;
+  uint64_t odd_carries = 0;
+  bool ends_odd_run = __builtin_add_overflow(backslash, odd_starts, &odd_carries);
+  odd_carries |= prev_odd_run;
+  prev_odd_run = ends_odd_run ? 1 : 0;
+  uint64_t even_carry_ends = even_carries & ~backslash;
+  uint64_t odd_carry_ends = odd_carries & ~backslash;
+  return (even_carry_ends & kOddBits) | (odd_carry_ends & kEvenBits);
+}
+
+uint64_t prefix_xor(uint64_t bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+}  // namespace
+
+const char* structural_kernel_name() {
+  return kernel().name;
+}
+
+StructuralIndex::StructuralIndex(std::string_view input)
+    : input_(input),
+      classify_(kernel().fn),
+      entries_(new uint32_t[std::min(input.size() + 64, kWindowBlocks * 64)]) {}
+
+size_t StructuralIndex::next_window(size_t pos) {
+  while (true) {
+    if (pos < window_pos_ && cursor_ < size_) {
+      return window_pos_ + (entries_[cursor_] & ~kDirty);
+    }
+    if (!fill()) {
+      return input_.size();
+    }
+    if (pos >= window_pos_) {
+      uint32_t rel = static_cast<uint32_t>(std::min<size_t>(pos - window_pos_, kDirty));
+      for (; cursor_ < size_; ++cursor_) {
+        if ((entries_[cursor_] & ~kDirty) >= rel) {
+          return window_pos_ + (entries_[cursor_] & ~kDirty);
+        }
+      }
+    }
+  }
+}
+
+bool StructuralIndex::string_end(size_t open, size_t& close, bool& dirty) {
+  if (next(open) != open) {
+    return false;
+  }
+  ++cursor_;
+  while (cursor_ >= size_) {
+    if (!fill()) {
+      return false;
+    }
+  }
+  uint32_t entry = entries_[cursor_];
+  close = window_pos_ + (entry & ~kDirty);
+  dirty = (entry & kDirty) != 0;
+  return input_[close] == '"';
+}
+
+size_t StructuralIndex::container_end(size_t open) {
+  size_t depth = 0;
+  for (size_t pos = next(open); pos < input_.size(); pos = next(pos + 1)) {
+    char c = input_[pos];
+    if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      if (--depth == 0) {
+        return pos;
+      }
+    }
+  }
+  return input_.size();
+}
+
+void StructuralIndex::seek(size_t pos) {
+  if (pos >= window_pos_ && pos < block_pos_) {
+    uint32_t rel = static_cast<uint32_t>(pos - window_pos_);
+    const uint32_t* first = entries_.get();
+    cursor_ = static_cast<size_t>(
+        std::lower_bound(first, first + size_, rel, [](uint32_t entry, uint32_t value) {
+          return (entry & ~kDirty) < value;
+        }) -
+        first);
+    return;
+  }
+  size_ = 0;
+  cursor_ = 0;
+  window_pos_ = pos;
+  block_pos_ = pos;
+  prev_escaped_ = 0;
+  prev_in_string_ = 0;
+  prev_whitespace_ = 1;
+  string_dirty_ = false;
+}
+
+bool StructuralIndex::fill() {
+  size_ = 0;
+  cursor_ = 0;
+  window_pos_ = block_pos_;
+  if (block_pos_ >= input_.size()) {
+    return false;
+  }
+  size_t end = std::min(input_.size(), block_pos_ + kWindowBlocks * 64);
+  while (block_pos_ < end) {
+    size_t remaining = input_.size() - block_pos_;
+    if (remaining >= 64) {
+      scan_block(input_.data() + block_pos_, block_pos_ - window_pos_, 64);
+    } else {
+      char tail[64];
+      std::memset(tail, ' ', sizeof(tail));
+      std::memcpy(tail, input_.data() + block_pos_, remaining);
+      scan_block(tail, block_pos_ - window_pos_, remaining);
+    }
+    block_pos_ += 64;
+  }
+  return true;
+}
+
+void StructuralIndex::scan_block(const char* block, size_t base, size_t valid) {
+  BlockMasks m;
+  classify_(block, m);
+
+  uint64_t escaped = find_escaped(m.backslash, prev_escaped_);
+  uint64_t quote = m.quote & ~escaped;
+  // Opening quotes count as inside their string, closing quotes as outside.
+  uint64_t in_string = prefix_xor(quote) ^ prev_in_string_;
+  prev_in_string_ = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+  uint64_t follows_ws = (m.whitespace << 1) | prev_whitespace_;
+  prev_whitespace_ = m.whitespace >> 63;
+
+  uint64_t outside = ~in_string;
+  uint64_t structurals = quote | (m.op & outside) | (~m.whitespace & outside & follows_ws);
+  if (valid < 64) {
+    structurals &= (1ULL << valid) - 1;
+    quote &= (1ULL << valid) - 1;
+  }
+
+  uint32_t* out = entries_.get() + size_;
+  uint32_t* end = out;
+  uint32_t offset = static_cast<uint32_t>(base);
+  for (uint64_t bits = structurals; bits != 0; bits &= bits - 1) {
+    *end++ = offset + static_cast<uint32_t>(__builtin_ctzll(bits));
+  }
+  size_ += static_cast<size_t>(end - out);
+
+  // Walk the (few) quotes to flag strings holding backslashes or control
+  // characters, carrying an open string's state into the next block.
+  uint64_t dirty_bytes = (m.backslash | m.control) & in_string;
+  uint64_t open_from = ~0ULL;
+  for (uint64_t q = quote; q != 0; q &= q - 1) {
+    uint64_t bit = q & (~q + 1);
+    if (in_string & bit) {
+      open_from = ~(bit - 1);
+      string_dirty_ = false;
+      continue;
+    }
+    if (string_dirty_ || (dirty_bytes & open_from & (bit - 1)) != 0) {
+      uint32_t* slot = end - 1;
+      while ((*slot & ~kDirty) != offset + static_cast<uint32_t>(__builtin_ctzll(bit))) {
+        --slot;
+      }
+      *slot |= kDirty;
+    }
+    string_dirty_ = false;
+    open_from = ~0ULL;
+  }
+  if (prev_in_string_ != 0 && (dirty_bytes & open_from) != 0) {
+    string_dirty_ = true;
+  }
+}
+
+}  // namespace detail
+}  // namespace jsonpath
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace jsonpath {
+namespace detail {
+
+// Per-block classification produced by the vectorized kernels; bit i describes
+// byte i of a 64-byte block.
+struct BlockMasks {
+  uint64_t quote = 0;
+  uint64_t backslash = 0;
+  uint64_t whitespace = 0;
+  uint64_t op = 0;
+  uint64_t control = 0;
+};
+
+using ClassifyFn = void (*)(const char* block, BlockMasks& masks);
+
+// Name of the kernel picked for this CPU: "avx2", "sse2" or "scalar".
+const char* structural_kernel_name();
+
+// Stage 1 of the JSON parser. Classifies the input 64 bytes at a time and
+// records every unescaped quote, every structural character outside strings
+// and the first byte of every token that follows whitespace. The index is
+// built one window at a time, so it stays cache resident for any input size;
+// positions must therefore be requested in non-decreasing order.
+class StructuralIndex {
+ public:
+  explicit StructuralIndex(std::string_view input);
+
+  // First indexed position at or after pos, or input.size() if none remain.
+  size_t next(size_t pos) {
+    if (pos >= window_pos_ && pos - window_pos_ < kDirty) {
+      uint32_t rel = static_cast<uint32_t>(pos - window_pos_);
+      for (; cursor_ < size_; ++cursor_) {
+        uint32_t entry = entries_[cursor_] & ~kDirty;
+        if (entry >= rel) {
+          return window_pos_ + entry;
+        }
+      }
+    }
+    return next_window(pos);
+  }
+
+  // For the opening quote at open, finds the matching closing quote and
+  // whether the string holds escapes or control characters. Returns false if
+  // open is not an indexed quote or the string is unterminated.
+  bool string_end(size_t open, size_t& close, bool& dirty);
+
+  // For the '{' or '[' at open, finds the bracket that closes it by counting
+  // the indexed brackets in between, or returns input.size() if unbalanced.
+  // Bracket kinds are not paired up, so this is for skipping, not validation.
+  size_t container_end(size_t open);
+
+  // Lets positions from pos on be requested again, even if pos lies behind
+  // the last one; pos must not be inside a string. Within the current window
+  // this only moves the cursor; otherwise indexing starts over at pos, so the
+  // bytes it skips are never classified.
+  void seek(size_t pos);
+
+ private:
+  // Entries are window-relative offsets; the top bit flags a closing quote
+  // whose string needs the escape-aware decoder.
+  static constexpr uint32_t kDirty = 1U << 31;
+  static constexpr size_t kWindowBlocks = 128;
+
+  std::string_view input_;
+  ClassifyFn classify_;
+  std::unique_ptr<uint32_t[]> entries_;
+  size_t size_ = 0;
+  size_t cursor_ = 0;
+  size_t window_pos_ = 0;
+  size_t block_pos_ = 0;
+  uint64_t prev_escaped_ = 0;
+  uint64_t prev_in_string_ = 0;
+  uint64_t prev_whitespace_ = 1;
+  bool string_dirty_ = false;
+
+  size_t next_window(size_t pos);
+  bool fill();
+  void scan_block(const char* block, size_t base, size_t valid);
+};
+
+}  // namespace detail
+}  // namespace jsonpath
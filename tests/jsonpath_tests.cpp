@@ -1,15 +1,40 @@
+#include "jsonpath/cache.hpp"
+#include "jsonpath/function.hpp"
 #include "jsonpath/jsonpath.hpp"
+#include "jsonpath/ndjson.hpp"
+#include "jsonpath/projection.hpp"
+#include "jsonpath/serialize.hpp"
 
 #include <gtest/gtest.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+// Counts allocations, for tests of code meant not to allocate.
+std::atomic<size_t> g_allocations{0};
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
 namespace {
 
-jsonpath::Json parse_doc() {
-  const char* doc = R"JSON(
+const char* kDocument = R"JSON(
   {
     "name": "Barry",
     "tags": ["a", "b", "c"],
@@ -26,9 +51,15 @@ jsonpath::Json parse_doc() {
     "misc": {"a": null, "b": true, "c": false}
   }
   )JSON";
-  return jsonpath::parse_json(doc);
+
+jsonpath::Json parse_doc() {
+  return jsonpath::parse_json(kDocument);
 }
 
+// Written while this file's statics are initialized, which may be before
+// the library's own.
+const std::string kWrittenAtStartup = jsonpath::to_json(jsonpath::Json("hello \"startup\""));
+
 bool contains_value(const std::vector<const jsonpath::Json*>& nodes, const jsonpath::Json& expected) {
   return std::any_of(nodes.begin(), nodes.end(), [&](const jsonpath::Json* node) {
     return jsonpath::json_equal(*node, expected);
@@ -62,6 +93,268 @@ TEST(JsonParser, ParsesStringsAndNumbers) {
   EXPECT_TRUE(obj.at("z")->is_null());
 }
 
+TEST(JsonParser, IntegersKeepFullPrecision) {
+  auto doc = jsonpath::parse_json(
+      R"JSON({"big": 9007199254740993, "max": 18446744073709551615, "min": -9223372036854775808,
+              "huge": 123456789012345678901234567890, "f": 2.5e-3, "i": 42})JSON");
+  const auto& obj = doc.as_object();
+  ASSERT_TRUE(obj.at("big")->is_integer());
+  EXPECT_EQ(obj.at("big")->as_int64(), 9007199254740993LL);
+  EXPECT_EQ(obj.at("max")->as_uint64(), 18446744073709551615ULL);
+  EXPECT_EQ(obj.at("min")->as_int64(), INT64_MIN);
+  EXPECT_TRUE(obj.at("huge")->is_double());
+  EXPECT_TRUE(jsonpath::parse_json("-9999999999999999999").is_double());
+  EXPECT_EQ(jsonpath::parse_json("-9999999999999999999").as_number(), -9999999999999999999.0);
+  EXPECT_EQ(obj.at("f")->as_number(), 2.5e-3);
+  EXPECT_EQ(obj.at("i")->as_number(), 42.0);
+  EXPECT_TRUE(jsonpath::json_equal(*obj.at("i"), jsonpath::Json(42.0)));
+  EXPECT_FALSE(jsonpath::json_equal(*obj.at("big"), jsonpath::Json(9007199254740992.0)));
+  EXPECT_THROW(jsonpath::parse_json("1e400"), std::runtime_error);
+  auto negative_zero = jsonpath::parse_json("[-0, 0, -0.0]");
+  ASSERT_TRUE(negative_zero.as_array()[0]->is_double());
+  EXPECT_TRUE(std::signbit(negative_zero.as_array()[0]->as_number()));
+  EXPECT_TRUE(negative_zero.as_array()[1]->is_integer());
+  EXPECT_EQ(jsonpath::to_json(negative_zero), "[-0.0,0,-0.0]");
+  EXPECT_EQ(jsonpath::select(negative_zero, "$[?@ == -0]").size(), 3u);
+
+  auto items = jsonpath::parse_json(R"JSON({"items": [{"id": 9007199254740992}, {"id": 9007199254740993}]})JSON");
+  auto exact = jsonpath::select(items, "$.items[?@.id == 9007199254740993]");
+  ASSERT_EQ(exact.size(), 1u);
+  EXPECT_EQ(exact[0]->as_object().at("id")->as_int64(), 9007199254740993LL);
+  EXPECT_EQ(jsonpath::select(items, "$.items[?@.id > 9007199254740992]").size(), 1u);
+  EXPECT_EQ(jsonpath::select(items, "$.items[?@.id <= 9007199254740993.0]").size(), 1u);
+}
+
+TEST(JsonParser, StringsSpanningIndexWindows) {
+  std::string text = "[";
+  std::vector<std::string> expected;
+  for (int i = 0; i < 600; ++i) {
+    std::string raw(static_cast<size_t>(i % 97), 'x');
+    std::string decoded = raw;
+    if (i % 3 == 0) {
+      raw += R"(\\\"q)";
+      decoded += R"(\"q)";
+    }
+    text += (i ? ",\n  \"" : "\"") + raw + "\"";
+    expected.push_back(decoded);
+  }
+  text += "]";
+  auto doc = jsonpath::parse_json(text);
+  const auto& arr = doc.as_array();
+  ASSERT_EQ(arr.size(), expected.size());
+  for (size_t i = 0; i < arr.size(); ++i) {
+    EXPECT_EQ(std::string_view(arr[i]->as_string()), expected[i]) << "element " << i;
+  }
+}
+
+TEST(JsonParser, ErrorsReportPosition) {
+  auto message = [](const char* text) {
+    try {
+      jsonpath::parse_json(text);
+    } catch (const std::runtime_error& e) {
+      return std::string(e.what());
+    }
+    return std::string("ok");
+  };
+  EXPECT_EQ(message("[1, 2"), "Unexpected end of input at position 5");
+  EXPECT_EQ(message(" \f[ 1 ,\n\t2 ]  x"), "Unexpected trailing characters at position 14");
+  EXPECT_EQ(message("\"ab\x01\""), "Control character in string at position 4");
+  EXPECT_EQ(message("[\"a\\\\\" , \"b\\q\"]"), "Invalid escape sequence at position 13");
+}
+
+TEST(JsonParser, DocumentAllocatesFromArena) {
+  jsonpath::Document doc;
+  const auto& root = jsonpath::parse_json(R"JSON({"name": "Barry", "tags": ["a", "b"], "nested": {"n": 1}})JSON", doc);
+  ASSERT_TRUE(root.is_object());
+  EXPECT_EQ(root.as_object().get_allocator().resource(), doc.resource());
+  const auto& name = std::get<jsonpath::Json::String>(root.as_object().at("name")->value);
+  EXPECT_EQ(name, "Barry");
+  EXPECT_EQ(name.get_allocator().resource(), doc.resource());
+  EXPECT_EQ(root.as_object().at("tags")->as_array().get_allocator().resource(), doc.resource());
+
+  auto tags = jsonpath::select(doc.root(), "$.tags[*]");
+  ASSERT_EQ(tags.size(), 2u);
+  EXPECT_EQ(tags[1]->as_string(), "b");
+
+  EXPECT_THROW(jsonpath::parse_json("[1, 2", doc), std::runtime_error);
+  EXPECT_EQ(jsonpath::select(doc.root(), "$.nested.n").size(), 1u);
+}
+
+TEST(JsonParser, DocumentInternsLongKeys) {
+  std::string text = "[";
+  for (int i = 0; i < 3; ++i) {
+    text += i ? ", {" : "{";
+    for (int k = 0; k < 20; ++k) {
+      text += (k ? ", \"" : "\"") + std::string("a_member_name_longer_than_inline_") + std::to_string(k) +
+              "\": " + std::to_string(i * 100 + k);
+    }
+    text += ", \"short\": 1, \"esc\\u0061ped_key_longer_than_inline\": 2}";
+  }
+  text += "]";
+  jsonpath::Document doc;
+  const auto& root = jsonpath::parse_json(text, doc);
+  const auto& first = root.as_array()[0]->as_object();
+  const auto& last = root.as_array()[2]->as_object();
+  ASSERT_EQ(first.size(), 22u);
+  EXPECT_TRUE(first.keys()[0].interned());
+  EXPECT_FALSE(first.keys()[20].interned());
+  EXPECT_EQ(first.keys()[0].view().data(), last.keys()[0].view().data());
+  EXPECT_EQ(first.keys()[21].view().data(), last.keys()[21].view().data());
+  EXPECT_EQ(last.keys()[21], "escaped_key_longer_than_inline");
+  EXPECT_FALSE(jsonpath::parse_json(text).as_array()[0]->as_object().keys()[0].interned());
+
+  auto picked = jsonpath::select(root, "$[*].a_member_name_longer_than_inline_17");
+  ASSERT_EQ(picked.size(), 3u);
+  EXPECT_EQ(picked[2]->as_number(), 217);
+  EXPECT_EQ(jsonpath::JsonPath::compile("$[1].a_member_name_longer_than_inline_3").get(root)->as_number(), 103);
+  EXPECT_EQ(jsonpath::select(root, "$[?@.a_member_name_longer_than_inline_19 > 100]").size(), 2u);
+
+  jsonpath::Json copy = *root.as_array()[1];
+  EXPECT_FALSE(copy.as_object().keys()[0].interned());
+  EXPECT_NE(copy.as_object().keys()[0].view().data(), first.keys()[0].view().data());
+  EXPECT_EQ(copy.as_object().keys()[5], "a_member_name_longer_than_inline_5");
+  EXPECT_EQ(copy.as_object().at("a_member_name_longer_than_inline_5")->as_number(), 105);
+}
+
+TEST(JsonParser, BorrowedStringsPointIntoInput) {
+  const std::string input =
+      R"JSON({"name": "Barry", "a_key_longer_than_inline": "x", "esc\u0061ped": "line\nbreak", "n": [1]})JSON";
+  auto inside = [&](std::string_view s) {
+    return s.data() >= input.data() && s.data() + s.size() <= input.data() + input.size();
+  };
+  jsonpath::ParseOptions options;
+  options.borrow_strings = true;
+  jsonpath::Document doc;
+  const auto& root = jsonpath::parse_json(input, doc, options);
+  const auto& obj = root.as_object();
+
+  const auto& name = *obj.at("name");
+  ASSERT_TRUE(std::holds_alternative<std::string_view>(name.value));
+  EXPECT_TRUE(inside(name.as_string()));
+  EXPECT_TRUE(obj.keys()[1].borrowed());
+  EXPECT_TRUE(inside(obj.keys()[1].view()));
+  EXPECT_EQ(obj.keys()[2], "escaped");
+  const auto& escaped = *obj.at("escaped");
+  ASSERT_TRUE(std::holds_alternative<jsonpath::Json::String>(escaped.value));
+  EXPECT_EQ(escaped.as_string(), "line\nbreak");
+
+  EXPECT_TRUE(jsonpath::json_equal(root, jsonpath::parse_json(input)));
+  EXPECT_EQ(jsonpath::select(root, "$.a_key_longer_than_inline").size(), 1u);
+  EXPECT_EQ(jsonpath::select(root, "$[?@ == 'Barry']").size(), 1u);
+  EXPECT_EQ(jsonpath::select(root, "$[?match(@, 'B.*')]").size(), 1u);
+
+  jsonpath::Json copy = root;
+  EXPECT_EQ(copy.as_object().keys()[1], "a_key_longer_than_inline");
+}
+
+TEST(JsonParser, RejectsDeepNesting) {
+  std::string deepest = std::string(1024, '[') + std::string(1024, ']');
+  EXPECT_EQ(jsonpath::parse_json(deepest).as_array().size(), 1u);
+  std::string hostile(100000, '[');
+  try {
+    jsonpath::parse_json(hostile);
+    FAIL() << "expected a depth error";
+  } catch (const std::runtime_error& e) {
+    EXPECT_STREQ(e.what(), "Maximum nesting depth exceeded at position 1024");
+  }
+  jsonpath::Document doc;
+  EXPECT_THROW(jsonpath::parse_json(hostile, doc), std::runtime_error);
+  EXPECT_THROW(jsonpath::select_raw(hostile, "$..x"), std::runtime_error);
+  EXPECT_THROW(jsonpath::select_ndjson("{}\n" + hostile, jsonpath::JsonPath::compile("$..x")), std::runtime_error);
+
+  jsonpath::ParseOptions shallow;
+  shallow.max_depth = 2;
+  EXPECT_NO_THROW(jsonpath::parse_json(R"([{"a": 1}, []])", shallow));
+  EXPECT_THROW(jsonpath::parse_json(R"([{"a": [1]}])", shallow), std::runtime_error);
+}
+
+TEST(JsonParser, ObjectsKeepDocumentOrder) {
+  std::string text = "{";
+  for (int i = 0; i < 40; ++i) {
+    text += (i ? ", \"k" : "\"k") + std::to_string(39 - i) + "\": " + std::to_string(i);
+  }
+  text += ", \"k5\": 100}";
+  auto doc = jsonpath::parse_json(text);
+  const auto& obj = doc.as_object();
+  ASSERT_EQ(obj.size(), 40u);
+  EXPECT_EQ(obj.keys().front(), "k39");
+  EXPECT_EQ(obj.at("k5")->as_number(), 100);
+  EXPECT_EQ(obj.keys()[34], "k5");
+  EXPECT_EQ(obj.find("missing"), obj.end());
+
+  auto all = jsonpath::select(doc, "$.*");
+  ASSERT_EQ(all.size(), 40u);
+  for (size_t i = 0; i < all.size(); ++i) {
+    EXPECT_EQ(all[i]->as_number(), i == 34 ? 100 : static_cast<double>(i));
+  }
+
+  jsonpath::Json::Object edited = obj;
+  EXPECT_EQ(edited.erase("k39"), 1u);
+  EXPECT_FALSE(edited.contains("k39"));
+  EXPECT_EQ(edited.keys().front(), "k38");
+  EXPECT_EQ(edited.at("k0")->as_number(), 39);
+  for (int i = 0; i < 39; i += 2) {
+    EXPECT_EQ(edited.erase("k" + std::to_string(i)), 1u);
+    for (int j = 0; j < 39; ++j) {
+      std::string key = "k" + std::to_string(j);
+      ASSERT_EQ(edited.contains(key), j > i || j % 2 == 1) << key;
+    }
+  }
+  ASSERT_EQ(edited.size(), 19u);
+  EXPECT_EQ(edited.keys().front(), "k37");
+  EXPECT_EQ(edited.at("k5")->as_number(), 100);
+  EXPECT_EQ(edited.at("k1")->as_number(), 38);
+  for (const char* key : {"k1", "k3", "k5", "k7"}) {
+    EXPECT_EQ(edited.erase(key), 1u);
+  }
+  EXPECT_EQ(edited.size(), 15u);
+  EXPECT_FALSE(edited.contains("k3"));
+  EXPECT_EQ(edited.at("k9")->as_number(), 30);
+}
+
+TEST(JsonParser, WritesJson) {
+  EXPECT_EQ(kWrittenAtStartup, R"("hello \"startup\"")");
+  auto doc = parse_doc();
+  std::string compact = jsonpath::to_json(doc);
+  EXPECT_EQ(compact.rfind(R"({"name":"Barry","tags":["a","b","c"],"numbers":[1,2,3,4,5,6],)", 0), 0u);
+  EXPECT_TRUE(jsonpath::json_equal(jsonpath::parse_json(compact), doc));
+  jsonpath::SerializeOptions pretty;
+  pretty.pretty = true;
+  EXPECT_TRUE(jsonpath::json_equal(jsonpath::parse_json(jsonpath::to_json(doc, pretty)), doc));
+  EXPECT_EQ(jsonpath::to_json(jsonpath::parse_json(R"JSON({"a": [1, {}], "b": []})JSON"), pretty),
+            "{\n  \"a\": [\n    1,\n    {}\n  ],\n  \"b\": []\n}");
+
+  auto scalars = jsonpath::parse_json(
+      R"JSON(["tab\there \"q\" back\\slash \u0001 \u00e9 and a long tail past one vector width", 1.0, -0.0, 0.1, 1e300,
+              -5, 18446744073709551615, true, null])JSON");
+  EXPECT_EQ(jsonpath::to_json(scalars),
+            R"JSON(["tab\there \"q\" back\\slash \u0001 )JSON"
+            "\xc3\xa9"
+            R"JSON( and a long tail past one vector width",1.0,-0.0,0.1,1e+300,)JSON"
+            R"JSON(-5,18446744073709551615,true,null])JSON");
+  EXPECT_THROW(jsonpath::to_json(jsonpath::Json(std::nan(""))), std::invalid_argument);
+
+  std::vector<std::string> pieces;
+  jsonpath::CallbackSink chunks([&](std::string_view piece) { pieces.emplace_back(piece); }, 16);
+  jsonpath::to_json(doc, chunks);
+  EXPECT_GT(pieces.size(), 1u);
+  std::string joined;
+  for (const auto& piece : pieces) {
+    joined += piece;
+  }
+  EXPECT_EQ(joined, compact);
+
+  char path[] = "/tmp/jsonpath_testXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  jsonpath::FdSink file(fd);
+  jsonpath::to_json(doc, file);
+  close(fd);
+  jsonpath::Document written;
+  EXPECT_TRUE(jsonpath::json_equal(jsonpath::parse_json_file(path, written), doc));
+  unlink(path);
+}
+
 TEST(JsonPath, BasicSelectors) {
   auto doc = parse_doc();
 
@@ -108,6 +401,316 @@ TEST(JsonPath, DescendantAndWildcard) {
   EXPECT_TRUE(contains_value(misc, jsonpath::Json(false)));
 }
 
+TEST(JsonPath, DescendantsInDocumentOrder) {
+  const size_t depth = 256;
+  std::string text;
+  for (size_t i = 0; i < depth; ++i) {
+    text += "{\"id\": " + std::to_string(i) + ", \"next\": [";
+  }
+  for (size_t i = 0; i < depth; ++i) {
+    text += "]}";
+  }
+  jsonpath::Document storage;
+  const jsonpath::Json& doc = jsonpath::parse_json(text, storage);
+
+  auto ids = jsonpath::select(doc, "$..id");
+  ASSERT_EQ(ids.size(), depth);
+  for (size_t i = 0; i < depth; ++i) {
+    EXPECT_EQ(ids[i]->as_number(), static_cast<double>(i));
+  }
+  EXPECT_EQ(jsonpath::select(doc, "$..next[0].id").size(), depth - 1);
+  EXPECT_EQ(jsonpath::select(doc, "$..[?@.id == 255].id").size(), 1u);
+}
+
+TEST(JsonPath, SelectReusesScratch) {
+  auto doc = parse_doc();
+  jsonpath::EvalScratch scratch;
+  std::vector<const jsonpath::Json*> out;
+  for (const char* query : {"$.items[*].colors[*]", "$..b", "$.items[?count(@.colors[*]) > 1 && @..id].author",
+                            "$..[?length(@) == 3]", "$.missing", "$"}) {
+    for (int pass = 0; pass < 2; ++pass) {
+      jsonpath::JsonPath::compile(query).select(doc, out, scratch);
+      EXPECT_EQ(out, jsonpath::select(doc, query)) << query;
+    }
+  }
+
+  jsonpath::register_function("fails_on_red", jsonpath::FunctionType::Logical, {jsonpath::FunctionType::Value},
+                              [](const jsonpath::FunctionArg* args, size_t) -> jsonpath::FunctionValue {
+                                if (args[0].value && args[0].value->is_string() && args[0].value->as_string() == "red") {
+                                  throw std::runtime_error("red");
+                                }
+                                return {};
+                              });
+  auto failing = jsonpath::JsonPath::compile("$..[?fails_on_red(@)]");
+  EXPECT_THROW(failing.select(doc, out, scratch), std::runtime_error);
+  jsonpath::JsonPath::compile("$..colors[0]").select(doc, out, scratch);
+  EXPECT_EQ(out, jsonpath::select(doc, "$..colors[0]"));
+}
+
+TEST(JsonPath, StopsAtFirstMatch) {
+  auto doc = parse_doc();
+  for (const char* query : {"$.items[*].colors[*]", "$..b", "$.items[?@.author == 'Bob'].id", "$.missing", "$"}) {
+    auto path = jsonpath::JsonPath::compile(query);
+    auto all = path.select(doc);
+    EXPECT_EQ(path.count(doc), all.size()) << query;
+    EXPECT_EQ(path.exists(doc), !all.empty()) << query;
+    EXPECT_EQ(path.select_first(doc), all.empty() ? nullptr : all.front()) << query;
+  }
+
+  static int calls = 0;
+  jsonpath::register_function("tick", jsonpath::FunctionType::Logical, {},
+                              [](const jsonpath::FunctionArg*, size_t) {
+                                ++calls;
+                                jsonpath::FunctionValue result;
+                                result.logical = true;
+                                return result;
+                              });
+  auto ticks = jsonpath::JsonPath::compile("$..[?tick()]");
+  EXPECT_TRUE(ticks.exists(doc));
+  EXPECT_EQ(calls, 1);
+
+  calls = 0;
+  std::vector<const jsonpath::Json*> seen;
+  EXPECT_FALSE(ticks.for_each(doc, [&](const jsonpath::Json& node) {
+    seen.push_back(&node);
+    return seen.size() < 3;
+  }));
+  EXPECT_EQ(calls, 3);
+  auto all = ticks.select(doc);
+  EXPECT_EQ(seen, std::vector<const jsonpath::Json*>(all.begin(), all.begin() + 3));
+  EXPECT_TRUE(ticks.for_each(doc, [](const jsonpath::Json&) { return true; }));
+}
+
+TEST(JsonPath, GetFollowsSingularQueries) {
+  auto doc = parse_doc();
+  for (const char* query : {"$", "$.items[0].id", "$.items[-1].colors[1]", "$['items'][1].b", "$.items[9]",
+                            "$.items.id", "$.numbers[0].x", "$.missing"}) {
+    auto path = jsonpath::JsonPath::compile(query);
+    auto all = path.select(doc);
+    EXPECT_EQ(path.get(doc), all.empty() ? nullptr : all.front()) << query;
+    EXPECT_EQ(path.select_first(doc), path.get(doc)) << query;
+  }
+  EXPECT_THROW(jsonpath::JsonPath::compile("$.items[*].id").get(doc), std::runtime_error);
+  EXPECT_THROW(jsonpath::JsonPath::compile("$..id").get(doc), std::runtime_error);
+
+  auto doc2 = jsonpath::parse_json(R"JSON({"a": {"b": [1, 2]}})JSON");
+  jsonpath::Json* target = jsonpath::JsonPath::compile("$.a.b[1]").get_mut(doc2);
+  ASSERT_NE(target, nullptr);
+  target->value = int64_t{5};
+  EXPECT_EQ(jsonpath::select(doc2, "$.a.b[1]").front()->as_number(), 5);
+}
+
+TEST(JsonPath, SelectWithPaths) {
+  auto doc = parse_doc();
+  auto author = jsonpath::JsonPath::compile("$.items[1].author").select_with_paths(doc);
+  ASSERT_EQ(author.size(), 1u);
+  EXPECT_EQ(author[0].path.normalized(), "$['items'][1]['author']");
+  auto elements = author[0].path.elements();
+  ASSERT_EQ(elements.size(), 3u);
+  EXPECT_TRUE(elements[1].is_index);
+  EXPECT_EQ(elements[1].index, 1u);
+  EXPECT_EQ(elements[2].name, "author");
+  EXPECT_EQ(jsonpath::JsonPath::compile("$").select_with_paths(doc)[0].path.normalized(), "$");
+
+  // A normalized path selects exactly the node it was reported for.
+  for (const char* query : {"$..b", "$..*", "$.items[?@.id > 1].colors[-1:]", "$..[?@ == 'red']", "$.misc['c','a']"}) {
+    auto path = jsonpath::JsonPath::compile(query);
+    auto nodes = path.select(doc);
+    auto located = path.select_with_paths(doc);
+    ASSERT_EQ(located.size(), nodes.size()) << query;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      EXPECT_EQ(located[i].node, nodes[i]) << query;
+      auto again = jsonpath::select(doc, located[i].path.normalized());
+      ASSERT_EQ(again.size(), 1u) << located[i].path.normalized();
+      EXPECT_EQ(again[0], nodes[i]) << located[i].path.normalized();
+    }
+  }
+
+  auto escaped = jsonpath::parse_json(R"JSON({"it's\\\n\u0001": [0]})JSON");
+  auto escaped_paths = jsonpath::JsonPath::compile("$.*[0]").select_with_paths(escaped);
+  ASSERT_EQ(escaped_paths.size(), 1u);
+  EXPECT_EQ(escaped_paths[0].path.normalized(), R"($['it\'s\\\n\u0001'][0])");
+}
+
+TEST(JsonPath, AssignRemoveUpdate) {
+  auto doc = parse_doc();
+
+  auto value = jsonpath::parse_json(R"JSON({"x": [1, "y"]})JSON");
+  EXPECT_EQ(jsonpath::JsonPath::compile("$.items[?@.author == 'Bob'].b").assign(doc, value), 2u);
+  auto assigned = jsonpath::select(doc, "$.items[*].b");
+  ASSERT_EQ(assigned.size(), 4u);
+  EXPECT_TRUE(jsonpath::json_equal(*assigned[0], value));
+  EXPECT_TRUE(jsonpath::json_equal(*assigned[3], value));
+  EXPECT_NE(assigned[0]->as_object().at("x").get(), assigned[3]->as_object().at("x").get());
+
+  auto bump = [](jsonpath::Json& node) { node = jsonpath::Json(node.as_int64() * 10); };
+  EXPECT_EQ(jsonpath::JsonPath::compile("$.numbers[0, 0, 1]").update(doc, bump), 2u);
+  auto numbers = jsonpath::select(doc, "$.numbers[:3]");
+  EXPECT_EQ(numbers[0]->as_number(), 10.0);
+  EXPECT_EQ(numbers[1]->as_number(), 20.0);
+  EXPECT_EQ(numbers[2]->as_number(), 3.0);
+
+  EXPECT_EQ(jsonpath::JsonPath::compile("$.numbers[?@ > 3]").remove(doc), 5u);
+  EXPECT_EQ(jsonpath::select(doc, "$.numbers[*]").size(), 1u);
+  EXPECT_EQ(jsonpath::JsonPath::compile("$..colors").remove(doc), 4u);
+  EXPECT_FALSE(jsonpath::JsonPath::compile("$..colors").exists(doc));
+  size_t all = jsonpath::JsonPath::compile("$..*").count(doc);
+  EXPECT_EQ(jsonpath::JsonPath::compile("$..*").remove(doc), all);
+  EXPECT_TRUE(doc.as_object().empty());
+  EXPECT_EQ(jsonpath::JsonPath::compile("$").remove(doc), 0u);
+
+  std::string wide_text = R"({"o": {)";
+  for (int i = 0; i < 2000; ++i) {
+    wide_text += (i ? ", \"" : "\"") + std::string(i % 3 ? "" : "a_long_member_name_") + std::to_string(i) +
+                 "\": " + std::to_string(i % 2);
+  }
+  wide_text += "}}";
+  auto wide = jsonpath::parse_json(wide_text);
+  EXPECT_EQ(jsonpath::JsonPath::compile("$.o[?@ == 1]").remove(wide), 1000u);
+  const auto& kept = wide.as_object().at("o")->as_object();
+  ASSERT_EQ(kept.size(), 1000u);
+  EXPECT_EQ(kept.keys()[0], "a_long_member_name_0");
+  EXPECT_EQ(kept.keys()[1], "2");
+  EXPECT_EQ(kept.keys()[998], "1996");
+  EXPECT_TRUE(kept.contains("a_long_member_name_1998"));
+  EXPECT_FALSE(kept.contains("a_long_member_name_3"));
+  EXPECT_FALSE(kept.contains("1999"));
+  EXPECT_EQ(jsonpath::select(wide, "$.o[?@ == 0]").size(), 1000u);
+
+  jsonpath::Document storage;
+  jsonpath::parse_json(R"JSON({"a": [{"n": 1}, {"n": 2}]})JSON", storage);
+  jsonpath::Json& root = storage.root();
+  EXPECT_EQ(jsonpath::JsonPath::compile("$.a[*].n").assign(root, jsonpath::Json("text")), 2u);
+  const auto& text = std::get<jsonpath::Json::String>(root.as_object().at("a")->as_array()[1]->as_object().at("n")->value);
+  EXPECT_EQ(text, "text");
+  EXPECT_EQ(text.get_allocator().resource(), storage.resource());
+
+  // A scalar root has no storage of its own to allocate the copy from; the
+  // Document overload must still put it in the arena, or it would leak.
+  jsonpath::Document scalar;
+  jsonpath::parse_json("1", scalar);
+  auto replacement = jsonpath::parse_json(R"JSON({"k": ["a long string value, not stored inline"]})JSON");
+  EXPECT_EQ(jsonpath::JsonPath::compile("$").assign(scalar, replacement), 1u);
+  ASSERT_TRUE(scalar.root().is_object());
+  EXPECT_EQ(scalar.root().as_object().get_allocator().resource(), scalar.resource());
+  EXPECT_TRUE(jsonpath::json_equal(scalar.root(), replacement));
+}
+
+TEST(JsonPath, ProjectsSelectedParts) {
+  const std::string text = R"JSON({
+    "user": {"name": "Ann", "email": "ann@example.com", "phone": "555"},
+    "orders": [{"id": 1, "total": 9.5}, {"id": 2, "items": [1, 2]}, {"total": 3}],
+    "debug": {"trace": [1, 2, 3]}
+  })JSON";
+  auto doc = jsonpath::parse_json(text);
+  jsonpath::Projection projection({jsonpath::JsonPath::compile("$.orders[*].id"),
+                                   jsonpath::JsonPath::compile("$.user.email"),
+                                   jsonpath::JsonPath::compile("$.user.name")});
+  const std::string expected = R"({"user":{"name":"Ann","email":"ann@example.com"},"orders":[{"id":1},{"id":2}]})";
+
+  std::string written;
+  jsonpath::StringSink sink(written);
+  projection.project(doc, sink);
+  EXPECT_EQ(written, expected);
+  EXPECT_EQ(jsonpath::to_json(projection.project(doc)), expected);
+  std::string raw;
+  jsonpath::StringSink raw_sink(raw);
+  projection.project_raw(text, raw_sink);
+  EXPECT_EQ(raw, expected);
+
+  // A match inside another is covered by it; subtrees are kept whole.
+  jsonpath::Projection nested({jsonpath::JsonPath::compile("$.orders[1]"), jsonpath::JsonPath::compile("$.orders[1].items[0]"),
+                               jsonpath::JsonPath::compile("$.missing")});
+  jsonpath::Json pruned = nested.project(doc);
+  EXPECT_EQ(jsonpath::to_json(pruned), R"({"orders":[{"id":2,"items":[1,2]}]})");
+  EXPECT_EQ(pruned.as_object().at("orders")->as_array()[0].get(), doc.as_object().at("orders")->as_array()[1].get());
+  raw.clear();
+  jsonpath::SerializeOptions pretty;
+  pretty.pretty = true;
+  nested.project_raw(text, raw_sink, pretty);
+  EXPECT_EQ(raw, "{\n  \"orders\": [\n    {\"id\": 2, \"items\": [1, 2]}\n  ]\n}");
+
+  // Descendant segments need the tree, so project_raw parses it.
+  raw.clear();
+  jsonpath::Projection ids({jsonpath::JsonPath::compile("$..id")});
+  ids.project_raw(text, raw_sink);
+  EXPECT_EQ(raw, R"({"orders":[{"id":1},{"id":2}]})");
+  EXPECT_EQ(jsonpath::to_json(jsonpath::Projection({jsonpath::JsonPath::compile("$.x")}).project(doc)), "{}");
+}
+
+TEST(JsonPath, PathSetMatchesEachQuery) {
+  auto doc = parse_doc();
+  const std::vector<std::string> queries = {"$.items[*].id",    "$.items[*].author", "$.items[?@.id > 2].b",
+                                            "$..colors[0]",     "$",                 "$.items[*].id",
+                                            "$.missing.x",      "$.items[1, 0].id",  "$.items[?@.id > 2].b"};
+  jsonpath::JsonPathSet set;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    EXPECT_EQ(set.add(jsonpath::JsonPath::compile(queries[i])), i);
+  }
+  ASSERT_EQ(set.size(), queries.size());
+  auto all = set.select(doc);
+  ASSERT_EQ(all.size(), queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    EXPECT_EQ(all[i], jsonpath::select(doc, queries[i])) << queries[i];
+  }
+
+  std::vector<size_t> reported;
+  jsonpath::EvalScratch scratch;
+  set.evaluate(doc, [&](size_t id, const std::vector<const jsonpath::Json*>&) { reported.push_back(id); }, scratch);
+  std::sort(reported.begin(), reported.end());
+  EXPECT_EQ(reported, (std::vector<size_t>{0, 1, 2, 3, 4, 5, 7, 8}));
+}
+
+TEST(JsonPath, CacheKeepsRecentQueries) {
+  auto doc = parse_doc();
+  jsonpath::JsonPathCache cache(2, 1);
+  EXPECT_EQ(cache.get("$.name").select(doc), jsonpath::select(doc, "$.name"));
+  cache.get("$.tags[0]");
+  cache.get("$.name");
+  cache.get("$.numbers[1]");
+  EXPECT_EQ(cache.size(), 2u);
+  cache.get("$.name");
+  cache.get("$.tags[0]");
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 2u);
+  EXPECT_EQ(stats.misses, 4u);
+  EXPECT_EQ(stats.evictions, 2u);
+
+  EXPECT_THROW(cache.get("$.["), std::runtime_error);
+  EXPECT_EQ(cache.size(), 2u);
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0u);
+  EXPECT_THROW(jsonpath::JsonPathCache(0), std::invalid_argument);
+
+  jsonpath::JsonPathCache uneven(100, 16);
+  EXPECT_EQ(uneven.capacity(), 100u);
+  for (int i = 0; i < 1000; ++i) {
+    uneven.get("$.numbers[" + std::to_string(i) + "]");
+  }
+  EXPECT_LE(uneven.size(), 100u);
+  EXPECT_EQ(uneven.stats().evictions, 1000u - uneven.size());
+
+  jsonpath::JsonPathCache shared(8, 4);
+  EXPECT_EQ(shared.capacity(), 8u);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&shared, &doc, t] {
+      for (int i = 0; i < 200; ++i) {
+        std::string query = "$.numbers[" + std::to_string((i + t) % 6) + "]";
+        auto result = shared.get(query).select(doc);
+        ASSERT_EQ(result.size(), 1u);
+        EXPECT_EQ(result[0]->as_number(), (i + t) % 6 + 1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  stats = shared.stats();
+  EXPECT_EQ(stats.hits + stats.misses, 800u);
+  EXPECT_LE(shared.size(), shared.capacity());
+}
+
 TEST(JsonPath, FilterSelectors) {
   auto doc = parse_doc();
 
@@ -125,6 +728,67 @@ TEST(JsonPath, FilterSelectors) {
   EXPECT_NE(find_item_by_id(id_ge_2, 4), nullptr);
 }
 
+TEST(JsonPath, HoistedOperandsDoNotAllocatePerNode) {
+  std::string text = R"({"lim": 500, "items": [)";
+  for (int i = 0; i < 1000; ++i) {
+    text += (i ? ",{\"p\": " : "{\"p\": ") + std::to_string(i) + "}";
+  }
+  text += "]}";
+  auto doc = jsonpath::parse_json(text);
+
+  jsonpath::EvalScratch scratch;
+  std::vector<const jsonpath::Json*> out;
+  for (const char* query :
+       {"$..[?@.p < $.lim]", "$.items[?@.p < $.lim]", "$..[?@.p < $.lim && $.items[?@.p == $.lim]]"}) {
+    auto path = jsonpath::JsonPath::compile(query);
+    // Node lists trade places with out, so every one needs a few passes to grow.
+    for (int pass = 0; pass < 3; ++pass) {
+      path.select(doc, out, scratch);
+    }
+    ASSERT_EQ(out.size(), 500u) << query;
+    size_t before = g_allocations;
+    path.select(doc, out, scratch);
+    EXPECT_EQ(g_allocations - before, 0u) << query;
+    EXPECT_EQ(out.size(), 500u) << query;
+  }
+}
+
+TEST(JsonPath, FilterLogicAndNestedQueries) {
+  auto doc = jsonpath::parse_json(R"JSON({"limit": 2, "rows": [
+    {"n": 1, "tags": ["a"], "m": {"k": [5, 6]}},
+    {"n": 2, "tags": [], "m": {"k": [7]}},
+    {"n": 3, "m": null},
+    {"n": 4, "tags": ["b", "c"]}
+  ]})JSON");
+
+  auto count = [&](const char* query) { return jsonpath::select(doc, query).size(); };
+  EXPECT_EQ(count("$.rows[?@.n > 1 && @.n < 4]"), 2u);
+  EXPECT_EQ(count("$.rows[?@.n == 1 || @.n == 4 || @.m == null]"), 3u);
+  EXPECT_EQ(count("$.rows[?!(@.n > 1) || !@.tags]"), 2u);
+  EXPECT_EQ(count("$.rows[?(@.n <= $.limit && @.tags) || @.m.k[-1] == 7]"), 2u);
+  EXPECT_EQ(count("$.rows[?@.m.k[-1] == 6]"), 1u);
+  EXPECT_EQ(count("$.rows[?@.tags[?@ == 'c']]"), 1u);
+  EXPECT_EQ(count("$.rows[?@..k && !@.tags[0]]"), 1u);
+  EXPECT_EQ(count("$.rows[?length(@.tags) == 0 || count(@.m.*) > 0]"), 2u);
+}
+
+TEST(JsonPath, FilterConstantsAgainstRoot) {
+  auto doc = parse_doc();
+  auto count = [&](const char* query) { return jsonpath::select(doc, query).size(); };
+  EXPECT_EQ(count("$.items[?@.author == $.items[0].author]"), 2u);
+  EXPECT_EQ(count("$.items[?@.id < $.numbers[2]]"), 2u);
+  EXPECT_EQ(count("$.items[?@.id > $.missing]"), 0u);
+  EXPECT_EQ(count("$.items[?$.missing == $.also_missing && @.b == 'k']"), 1u);
+  EXPECT_EQ(count("$.items[?count($.numbers[*]) == 6 && @.id >= 3]"), 2u);
+  EXPECT_EQ(count("$.items[?length($.name) > @.id]"), 4u);
+  EXPECT_EQ(count("$.items[?$.nested.obj && !$.empty[0]]"), 4u);
+  EXPECT_EQ(count("$.items[?$..deep || @.id == 1]"), 1u);
+  EXPECT_EQ(count("$.items[?@.colors[?@ == $.items[3].colors[0]]]"), 1u);
+  EXPECT_EQ(count("$.items[?1 == 1 && @.id == 2]"), 1u);
+  EXPECT_EQ(count("$.items[?'a' > 'b' || @.id == 2]"), 1u);
+  EXPECT_EQ(count("$.items[?!(null != null)]"), 4u);
+}
+
 TEST(JsonPath, SliceWithNegativeStep) {
   auto doc = parse_doc();
   auto slice = jsonpath::select(doc, "$.numbers[4:1:-2]");
@@ -157,6 +821,84 @@ TEST(JsonPath, Functions) {
   EXPECT_NE(find_item_by_id(value_sel, 1), nullptr);
 }
 
+TEST(JsonPath, RegexFunctions) {
+  auto doc = jsonpath::parse_json(R"JSON([
+    {"name": "café", "re": "c.f."},
+    {"name": "cafe\nbar", "re": "bar"},
+    {"name": "^abc$", "re": "[^a]+"}
+  ])JSON");
+
+  // "." is one code point, never a line break.
+  EXPECT_EQ(jsonpath::select(doc, "$[?match(@.name, 'caf.')].name").size(), 1u);
+  EXPECT_EQ(jsonpath::select(doc, "$[?search(@.name, 'e.b')].name").size(), 0u);
+  EXPECT_EQ(jsonpath::select(doc, "$[?search(@.name, '[^a-z]')].name").size(), 3u);
+  EXPECT_EQ(jsonpath::select(doc, "$[?match(@.name, 'c(af|x)[eé]{1,2}')].name").size(), 1u);
+
+  // Patterns read from the document.
+  EXPECT_EQ(jsonpath::select(doc, "$[?match(@.name, @.re)].name").size(), 1u);
+  EXPECT_EQ(jsonpath::select(doc, "$[?search(@.name, @.re)].name").size(), 3u);
+
+  // Anchors and other ECMAScript-only syntax still go through std::regex.
+  EXPECT_EQ(jsonpath::select(doc, "$[?search(@.name, '^caf')].name").size(), 2u);
+  EXPECT_EQ(jsonpath::select(doc, "$[?search(@.name, '\\\\d|\\\\$')].name").size(), 1u);
+  EXPECT_EQ(jsonpath::select(doc, "$[?match(@.name, '(')].name").size(), 0u);
+}
+
+TEST(JsonPath, CustomFunctions) {
+  using jsonpath::FunctionArg;
+  using jsonpath::FunctionType;
+  using jsonpath::FunctionValue;
+  jsonpath::register_function("first", FunctionType::Value, {FunctionType::Nodes},
+                              [](const FunctionArg* args, size_t) {
+                                FunctionValue result;
+                                if (!args[0].nodes->empty()) {
+                                  result.ref = args[0].nodes->front();
+                                }
+                                return result;
+                              });
+  jsonpath::register_function("starts_with", FunctionType::Logical, {FunctionType::Value, FunctionType::Value},
+                              [](const FunctionArg* args, size_t) {
+                                FunctionValue result;
+                                if (args[0].value && args[1].value && args[0].value->is_string() &&
+                                    args[1].value->is_string()) {
+                                  std::string_view prefix = args[1].value->as_string();
+                                  result.logical = args[0].value->as_string().substr(0, prefix.size()) == prefix;
+                                }
+                                return result;
+                              });
+  jsonpath::register_function("either", FunctionType::Logical, {FunctionType::Logical, FunctionType::Logical},
+                              [](const FunctionArg* args, size_t) {
+                                FunctionValue result;
+                                result.logical = args[0].logical || args[1].logical;
+                                return result;
+                              });
+
+  auto doc = parse_doc();
+  auto first_sel = jsonpath::select(doc, "$.items[?first(@.colors[*]) == 'red']");
+  ASSERT_EQ(first_sel.size(), 1u);
+  EXPECT_NE(find_item_by_id(first_sel, 1), nullptr);
+  EXPECT_EQ(jsonpath::select(doc, "$.items[?starts_with(@.date, '1974')]").size(), 2u);
+  EXPECT_EQ(jsonpath::select(doc, "$.items[?either(@.id == 2, starts_with(@.author, 'A'))]").size(), 2u);
+  EXPECT_EQ(jsonpath::select(doc, "$.items[?@.author == first($.items[*].author)]").size(), 2u);
+
+  auto compiled = jsonpath::JsonPath::compile("$.items[?starts_with(@.date, '1974')]");
+  jsonpath::register_function("starts_with", FunctionType::Logical, {FunctionType::Value, FunctionType::Value},
+                              [](const FunctionArg*, size_t) {
+                                FunctionValue result;
+                                result.logical = true;
+                                return result;
+                              });
+  EXPECT_EQ(jsonpath::select(doc, "$.items[?starts_with(@.date, '1974')]").size(), 4u);
+  EXPECT_EQ(compiled.select(doc).size(), 2u);
+
+  EXPECT_THROW(jsonpath::select(doc, "$.items[?first(@.colors[*])]"), std::runtime_error);
+  EXPECT_THROW(jsonpath::select(doc, "$.items[?starts_with(@.colors[*], 'r')]"), std::runtime_error);
+  EXPECT_THROW(jsonpath::register_function("length", FunctionType::Value, {FunctionType::Value}, nullptr),
+               std::invalid_argument);
+  EXPECT_THROW(jsonpath::register_function("Upper", FunctionType::Value, {FunctionType::Value}, nullptr),
+               std::invalid_argument);
+}
+
 TEST(JsonPath, ComparisonWithMissingNodes) {
   auto doc = jsonpath::parse_json(R"JSON([{"x": 1}])JSON");
 
@@ -170,6 +912,166 @@ TEST(JsonPath, ComparisonWithMissingNodes) {
   EXPECT_EQ(missing_false.size(), 0u);
 }
 
+TEST(JsonPath, SelectRawMatchesSelect) {
+  auto doc = parse_doc();
+  const char* queries[] = {
+      "$",
+      "$.name",
+      "$.tags[1]",
+      "$.tags[-1]",
+      "$.numbers[1:5:2]",
+      "$.numbers[::-1]",
+      "$.items[*].author",
+      "$['misc','name']",
+      "$.items[?@.id > 2].b",
+      "$.misc.*",
+      "$.missing.x",
+      "$.name[0]",
+      "$.items[?@.author == $.items[0].author].id",
+      "$..b",
+  };
+  for (const char* query : queries) {
+    auto expected = jsonpath::select(doc, query);
+    auto raw = jsonpath::select_raw(kDocument, query);
+    ASSERT_EQ(raw.size(), expected.size()) << query;
+    for (size_t i = 0; i < raw.size(); ++i) {
+      EXPECT_TRUE(jsonpath::json_equal(raw[i], *expected[i])) << query << " #" << i;
+    }
+  }
+}
+
+TEST(JsonPath, SelectRawOverManyIndexWindows) {
+  std::string text = R"({"meta": {"n": 300}, "records": [)";
+  for (int i = 0; i < 300; ++i) {
+    text += (i ? ", " : "") + std::string(R"({"id": )") + std::to_string(i) + R"(, "pad": ")" +
+            std::string(static_cast<size_t>(i % 97), 'x') + R"(", "user": {"name": "u)" + std::to_string(i) +
+            R"(", "tags": ["a\"]", "b", "c"]}, "ok": )" + (i % 3 ? "true" : "false") + "}";
+  }
+  text += R"(], "tail": [1, 2, 3]})";
+  auto doc = jsonpath::parse_json(text);
+  for (const char* query : {"$.records[*].user.name", "$.records[-1].id", "$.records[5:300:7]['id','ok']",
+                            "$.records[?@.ok].user.tags[0]", "$['tail','meta'][*]", "$.records[299,0,150].user",
+                            "$.records[*].user.tags[1:]", "$.tail[-1]", "$"}) {
+    auto expected = jsonpath::select(doc, query);
+    auto raw = jsonpath::select_raw(text, query);
+    ASSERT_EQ(raw.size(), expected.size()) << query;
+    for (size_t i = 0; i < raw.size(); ++i) {
+      EXPECT_TRUE(jsonpath::json_equal(raw[i], *expected[i])) << query << " #" << i;
+    }
+  }
+
+  jsonpath::Projection projection({jsonpath::JsonPath::compile("$.records[*].user.name"),
+                                   jsonpath::JsonPath::compile("$.records[?@.id > 290].pad"),
+                                   jsonpath::JsonPath::compile("$.tail[1]")});
+  std::string raw;
+  jsonpath::StringSink sink(raw);
+  projection.project_raw(text, sink);
+  EXPECT_EQ(raw, jsonpath::to_json(projection.project(doc)));
+}
+
+TEST(JsonPath, SelectRawSkipsUnvisitedInput) {
+  const char* input = R"JSON({"meta": {"skip": [{"x": "]}"}, 2], "tenant": "acme"}, "rest": [1, 2, oops)JSON";
+  auto path = jsonpath::JsonPath::compile("$.meta.tenant");
+  auto result = path.select_raw(input);
+  ASSERT_EQ(result.size(), 1u);
+  EXPECT_EQ(result[0].as_string(), "acme");
+  EXPECT_THROW(jsonpath::parse_json(input), std::runtime_error);
+  EXPECT_THROW(jsonpath::select_raw(input, "$.rest[5]"), std::runtime_error);
+}
+
+TEST(JsonPath, SelectStreamReadsChunks) {
+  const std::string input = R"JSON({"records": [
+    {"user": {"id": 1}, "status": "ok"},
+    {"user": {"id": 2}, "status": "error", "note": "a \"quoted\" ]}"},
+    {"user": {"id": 3}, "status": "error"}
+  ], "total": 3})JSON";
+  size_t offset = 0;
+  auto one_byte = [&](char* buffer, size_t) {
+    if (offset == input.size()) {
+      return size_t{0};
+    }
+    buffer[0] = input[offset++];
+    return size_t{1};
+  };
+  std::vector<jsonpath::Json> ids;
+  jsonpath::JsonPath::compile("$.records[*].user.id").select_stream(one_byte, [&](const jsonpath::Json& match) {
+    ids.push_back(match);
+  });
+  ASSERT_EQ(ids.size(), 3u);
+  EXPECT_EQ(ids[2].as_int64(), 3);
+
+  std::istringstream stream(input);
+  std::vector<int64_t> errors;
+  jsonpath::JsonPath::compile("$.records[?@.status == 'error'].user.id")
+      .select_stream(stream, [&](const jsonpath::Json& match) { errors.push_back(match.as_int64()); });
+  EXPECT_EQ(errors, (std::vector<int64_t>{2, 3}));
+
+  std::istringstream root_filter(input);
+  EXPECT_THROW(jsonpath::JsonPath::compile("$.records[?@.user.id == $.total]")
+                   .select_stream(root_filter, [](const jsonpath::Json&) {}),
+               std::runtime_error);
+  std::istringstream truncated(input.substr(0, 60));
+  EXPECT_THROW(jsonpath::JsonPath::compile("$.total").select_stream(truncated, [](const jsonpath::Json&) {}),
+               std::runtime_error);
+}
+
+TEST(JsonPath, SelectNdjsonTagsLines) {
+  std::string input;
+  for (int i = 0; i < 200; ++i) {
+    input += i % 7 == 3 ? "\n" : "{\"id\": " + std::to_string(i) + ", \"tags\": [\"t\"]}\n";
+  }
+  input += "{\"id\": 200}";
+  auto path = jsonpath::JsonPath::compile("$.id");
+  jsonpath::NdjsonOptions options;
+  options.threads = 4;
+  options.batch_bytes = 64;
+  auto ordered = jsonpath::select_ndjson(input, path, options);
+  ASSERT_EQ(ordered.size(), 201u - 29u);
+  for (const auto& match : ordered) {
+    EXPECT_EQ(match.value.as_int64() + 1, static_cast<int64_t>(match.line));
+  }
+  EXPECT_TRUE(std::is_sorted(ordered.begin(), ordered.end(),
+                             [](const auto& a, const auto& b) { return a.line < b.line; }));
+
+  options.ordered = false;
+  auto unordered = jsonpath::select_ndjson(input, path, options);
+  EXPECT_EQ(unordered.size(), ordered.size());
+
+  input.insert(input.find("{\"id\": 50"), "{oops}\n");
+  try {
+    jsonpath::select_ndjson(input, jsonpath::JsonPath::compile("$.*"), options);
+    FAIL() << "expected a parse error";
+  } catch (const std::runtime_error& e) {
+    EXPECT_EQ(std::string(e.what()).rfind("line 51: ", 0), 0u) << e.what();
+  }
+}
+
+TEST(JsonPath, FileInputIsMapped) {
+  char path[] = "/tmp/jsonpath_testXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  const std::string text = R"JSON({"meta": {"tenant": "acme-corporation-eu"}, "rows": [1, 2]})JSON";
+  ASSERT_EQ(write(fd, text.data(), text.size()), static_cast<ssize_t>(text.size()));
+  close(fd);
+
+  jsonpath::Document doc;
+  jsonpath::ParseOptions options;
+  options.borrow_strings = true;
+  const auto& root = jsonpath::parse_json_file(path, doc, options);
+  auto tenant = jsonpath::select(root, "$.meta.tenant");
+  ASSERT_EQ(tenant.size(), 1u);
+  EXPECT_TRUE(std::holds_alternative<std::string_view>(tenant[0]->value));
+  EXPECT_EQ(tenant[0]->as_string(), "acme-corporation-eu");
+
+  auto rows = jsonpath::select_file(path, jsonpath::JsonPath::compile("$.rows[*]"));
+  ASSERT_EQ(rows.size(), 2u);
+  EXPECT_EQ(rows[1].as_int64(), 2);
+
+  unlink(path);
+  EXPECT_EQ(tenant[0]->as_string(), "acme-corporation-eu");
+  EXPECT_THROW(jsonpath::parse_json_file(path, doc), std::runtime_error);
+}
+
 TEST(JsonPath, InvalidQueriesThrow) {
   auto doc = parse_doc();
 